@@ -7,84 +7,103 @@
  * @cite https://towardsdatascience.com/understanding-cosine-similarity-and-its-application-fd42f585296a
  */
 
+#include <algorithm>
 #include <fstream>
 
 #include "CSVData.h"
+#include "Trace.h"
 
 using namespace std;
 
+// Bytes read at a time (one page), so reading the first rows of a file does
+// not read all of it
+const size_t CSV_BLOCK_SIZE = 1 << 12;
+
 /**
  * @brief Reads a CSV file as a vector of vectors of fields.
  *
  * @param path The filename
  * @param data The CSVData
+ * @param maxRows Stop after this many rows (0: read them all)
  * @return Function succeeded
  */
-bool readCSV(const string path, CSVData &data)
+bool readCSV(const string path, CSVData &data, size_t maxRows)
 {
+    TRACE_SCOPE("parse CSV", path);
     ifstream file(path, ios_base::binary);
 
     if (!file.is_open())
         return false;
 
-    file.seekg(0, ios::end);
-    size_t fileSize = file.tellg();
-    char *fileData = new char[fileSize];
-    file.seekg(0);
-    file.read(&fileData[0], fileSize);
+    vector<char> block(CSV_BLOCK_SIZE);
 
     bool inQuotes = false;
     bool lastQuote = false;
+    bool isDone = false;
 
     string field;
     vector<string> fields;
 
-    for (size_t i = 0; i < fileSize; i++)
+    while (!isDone)
     {
-        char c = fileData[i];
-
-        if (lastQuote && c != '"')
-            inQuotes = !inQuotes;
+        file.read(block.data(), block.size());
+        size_t blockSize = file.gcount();
+        if (!blockSize)
+            break;
 
-        if (c == '"')
+        for (size_t i = 0; i < blockSize; i++)
         {
-            if (lastQuote)
+            char c = block[i];
+
+            if (lastQuote && c != '"')
+                inQuotes = !inQuotes;
+
+            if (c == '"')
             {
-                field += c;
+                if (lastQuote)
+                {
+                    field += c;
+                    lastQuote = false;
+                }
+                else
+                    lastQuote = true;
+            }
+            else if (c == ',')
+            {
+                if (inQuotes)
+                    field += c;
+                else
+                {
+                    fields.push_back(field);
+                    field.clear();
+                }
+
                 lastQuote = false;
             }
-            else
-                lastQuote = true;
-        }
-        else if (c == ',')
-        {
-            if (inQuotes)
-                field += c;
-            else
+            else if ((c == '\n') || (c == '\r'))
             {
-                fields.push_back(field);
+                if (field.size())
+                    fields.push_back(field);
                 field.clear();
-            }
 
-            lastQuote = false;
-        }
-        else if ((c == '\n') || (c == '\r'))
-        {
-            if (field.size())
-                fields.push_back(field);
-            field.clear();
+                if (fields.size())
+                    data.push_back(fields);
+                fields.clear();
 
-            if (fields.size())
-                data.push_back(fields);
-            fields.clear();
+                inQuotes = false;
+                lastQuote = false;
 
-            inQuotes = false;
-            lastQuote = false;
-        }
-        else
-        {
-            field += c;
-            lastQuote = false;
+                if (maxRows && data.size() >= maxRows)
+                {
+                    isDone = true;
+                    break;
+                }
+            }
+            else
+            {
+                field += c;
+                lastQuote = false;
+            }
         }
     }
 
@@ -93,13 +112,15 @@ bool readCSV(const string path, CSVData &data)
     if (fields.size())
         data.push_back(fields);
 
-    delete[] fileData;
-
     return true;
 }
 
 /**
- * @brief Writes a vector of vectors of fields to a CSV file.
+ * @brief Writes a vector of vectors of fields to a CSV file. Fields are
+ *        quoted, except those made of digits only.
+ *
+ * readCSV ends a row at '\n' or '\r', even within quotes, so fields must
+ * not hold them.
  *
  * @param path The filename
  * @param data The CSVData
@@ -124,6 +145,15 @@ bool writeCSV(const string path, CSVData &data)
             else
                 isFirstField = false;
 
+            // Numbers are written bare, like the counts of resources/trigrams
+            bool isNumber = !field.empty() &&
+                            all_of(field.begin(), field.end(), [](char c) { return c >= '0' && c <= '9'; });
+            if (isNumber)
+            {
+                line += field;
+                continue;
+            }
+
             // Replaces double quotes character "\""" with string "\"\"""
             size_t pos = 0;
             while ((pos = field.find('"', pos)) != std::string::npos)
@@ -16,7 +16,7 @@
 // CSVData: vector of vector of fields
 typedef std::vector<std::vector<std::string>> CSVData;
 
-bool readCSV(const std::string path, CSVData &data);
+bool readCSV(const std::string path, CSVData &data, size_t maxRows = 0);
 bool writeCSV(const std::string path, CSVData &data);
 
 #endif
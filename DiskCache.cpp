@@ -0,0 +1,352 @@
+/**
+ * @brief Lequel? persistent per-file cache of identification results
+ * @author Dylan Frigerio, Micaela Dinsen
+ *
+ * @copyright Copyright (c) 2022-2023
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+#include <sys/stat.h>
+
+#include "DiskCache.h"
+
+using namespace std;
+
+namespace
+{
+    template <typename T>
+    inline bool readValue(ifstream &file, T &value)
+    {
+        return (bool)file.read((char *)&value, sizeof(value));
+    }
+
+    template <typename T>
+    inline void writeValue(ofstream &file, const T &value)
+    {
+        file.write((const char *)&value, sizeof(value));
+    }
+
+    // Longest language code and read settings accepted when reading, to
+    // reject corrupt files
+    const uint32_t MAX_LANGUAGE_CODE_SIZE = 64;
+    const uint32_t MAX_READ_SETTINGS_SIZE = 256;
+
+    inline bool readString(ifstream &file, string &value, uint32_t maxSize)
+    {
+        uint32_t size;
+        if (!readValue(file, size) || size > maxSize)
+            return false;
+
+        value.resize(size);
+        return size == 0 || (bool)file.read(&value[0], size);
+    }
+
+    inline void writeString(ofstream &file, const string &value)
+    {
+        writeValue(file, (uint32_t)value.size());
+        file.write(value.data(), value.size());
+    }
+}
+
+/**
+ * @brief Reads the identity of a regular file.
+ *
+ * @param path Path of the file
+ * @param identity Destination identity
+ * @return Function succeeded (false for pipes and other special files,
+ *         which cannot be cached)
+ */
+bool getFileIdentity(const string &path, FileIdentity &identity)
+{
+    struct stat fileStat;
+    if (stat(path.c_str(), &fileStat) < 0 || !S_ISREG(fileStat.st_mode))
+        return false;
+
+    identity.device = (uint64_t)fileStat.st_dev;
+    identity.inode = (uint64_t)fileStat.st_ino;
+    identity.size = (uint64_t)fileStat.st_size;
+    identity.modificationTime = (int64_t)fileStat.st_mtim.tv_sec * 1000000000 + fileStat.st_mtim.tv_nsec;
+    return true;
+}
+
+/**
+ * @brief Loads a cache file. A missing file (or one of an older format) is
+ *        an empty cache; entries of other model versions are kept, for
+ *        their profiles.
+ *
+ * @param path The cache file
+ * @param modelVersion Version of the model in use (see getModelVersion)
+ * @param readSettings How files are read (bytes read, sample windows):
+ *                     profiles read otherwise are not reused
+ * @return Function succeeded
+ */
+bool DiskCache::open(const string &path, uint64_t modelVersion, const string &readSettings)
+{
+    lock_guard<mutex> guard(lock);
+
+    this->path = path;
+    this->modelVersion = modelVersion;
+    this->readSettings = readSettings;
+    isModified = false;
+    entries.clear();
+
+    ifstream file(path, ios::binary);
+    if (!file.is_open())
+        return true;
+
+    char magic[4];
+    uint32_t version, packing;
+    uint64_t entryNum;
+
+    if (!file.read(magic, sizeof(magic)) || !readValue(file, version) || !readValue(file, packing) ||
+        !readValue(file, entryNum) || memcmp(magic, DISK_CACHE_MAGIC, sizeof(magic)))
+    {
+        fprintf(stderr, "Error while reading cache %s: not a cache file\n", path.c_str());
+        return false;
+    }
+
+    // Entries of another format or stored profiles of another packing
+    // cannot be reused: start over
+    if (version != DISK_CACHE_VERSION || packing != (uint32_t)TRIGRAM_PACKING)
+    {
+        isModified = true;
+        return true;
+    }
+
+    for (uint64_t i = 0; i < entryNum; i++)
+    {
+        Entry entry;
+        uint64_t rowNum;
+
+        if (!readValue(file, entry.identity) || !readValue(file, entry.modelVersion) ||
+            !readValue(file, entry.guess.similarity) || !readValue(file, entry.guess.margin) ||
+            !readValue(file, entry.sampledFraction) ||
+            !readString(file, entry.guess.languageCode, MAX_LANGUAGE_CODE_SIZE) ||
+            !readString(file, entry.readSettings, MAX_READ_SETTINGS_SIZE) ||
+            !readValue(file, entry.profileSampledFraction) || !readValue(file, rowNum))
+            break;
+
+        // A text has fewer distinct trigrams than bytes
+        if (rowNum > entry.identity.size)
+            break;
+
+        entry.profile.resize(rowNum);
+        for (auto &[trigram, frequency] : entry.profile)
+        {
+            if (!readValue(file, trigram) || !readValue(file, frequency))
+                break;
+        }
+        if (!file)
+            break;
+
+        auto key = make_pair(entry.identity.device, entry.identity.inode);
+        entries[key] = move(entry);
+    }
+
+    if (entries.size() != entryNum)
+    {
+        fprintf(stderr, "Error while reading cache %s: truncated, kept %zu entries\n",
+                path.c_str(), entries.size());
+        isModified = true;
+    }
+    return true;
+}
+
+/**
+ * @brief Writes the cache back (if it changed), through a temporary file
+ *        that replaces the old one, so a crash never leaves a torn cache.
+ *        Entries of files this run did not look up are dropped.
+ *
+ * Each entry is its FileIdentity, uint64 model version, float similarity,
+ * float margin, double sampled fraction, uint32 language code size, the
+ * language code, uint32 read settings size, the read settings, double
+ * profile sampled fraction, uint64 profile row count and the (uint64
+ * trigram, float frequency) rows.
+ *
+ * @return Function succeeded
+ */
+bool DiskCache::save()
+{
+    lock_guard<mutex> guard(lock);
+
+    if (path.empty())
+        return true;
+
+    for (auto it = entries.begin(); it != entries.end();)
+    {
+        if (it->second.isUsed)
+        {
+            ++it;
+            continue;
+        }
+        it = entries.erase(it);
+        isModified = true;
+    }
+
+    if (!isModified)
+        return true;
+
+    const string temporaryPath = path + ".tmp";
+    {
+        ofstream file(temporaryPath, ios::binary | ios::trunc);
+        if (!file.is_open())
+        {
+            perror(("Error while writing cache " + temporaryPath).c_str());
+            return false;
+        }
+
+        const uint32_t packing = (uint32_t)TRIGRAM_PACKING;
+        const uint64_t entryNum = entries.size();
+
+        file.write(DISK_CACHE_MAGIC, sizeof(DISK_CACHE_MAGIC));
+        writeValue(file, DISK_CACHE_VERSION);
+        writeValue(file, packing);
+        writeValue(file, entryNum);
+
+        for (const auto &[key, entry] : entries)
+        {
+            writeValue(file, entry.identity);
+            writeValue(file, entry.modelVersion);
+            writeValue(file, entry.guess.similarity);
+            writeValue(file, entry.guess.margin);
+            writeValue(file, entry.sampledFraction);
+            writeString(file, entry.guess.languageCode);
+            writeString(file, entry.readSettings);
+            writeValue(file, entry.profileSampledFraction);
+            writeValue(file, (uint64_t)entry.profile.size());
+            for (const auto &[trigram, frequency] : entry.profile)
+            {
+                writeValue(file, trigram);
+                writeValue(file, frequency);
+            }
+        }
+
+        if (!file.flush())
+        {
+            perror(("Error while writing cache " + temporaryPath).c_str());
+            return false;
+        }
+    }
+
+    if (rename(temporaryPath.c_str(), path.c_str()) < 0)
+    {
+        perror(("Error while writing cache " + path).c_str());
+        return false;
+    }
+
+    isModified = false;
+    return true;
+}
+
+/**
+ * @brief Finds the entry of a file, if the file did not change since, and
+ *        marks it as used so save() keeps it.
+ */
+DiskCache::Entry *DiskCache::findEntry(const FileIdentity &identity)
+{
+    auto it = entries.find(make_pair(identity.device, identity.inode));
+    if (it == entries.end() || it->second.identity.size != identity.size ||
+        it->second.identity.modificationTime != identity.modificationTime)
+        return nullptr;
+
+    it->second.isUsed = true;
+    return &it->second;
+}
+
+/**
+ * @brief Looks up the result of an unchanged file for the current model.
+ *
+ * @param identity Identity of the file
+ * @param guess Receives the cached result
+ * @param sampledFraction If not null, receives the fraction of the file
+ *                        read for the result
+ * @return Whether the result was cached
+ */
+bool DiskCache::getResult(const FileIdentity &identity, LanguageGuess &guess, double *sampledFraction)
+{
+    lock_guard<mutex> guard(lock);
+
+    const Entry *entry = findEntry(identity);
+    if (!entry || entry->modelVersion != modelVersion)
+        return false;
+
+    guess = entry->guess;
+    if (sampledFraction)
+        *sampledFraction = entry->sampledFraction;
+    return true;
+}
+
+/**
+ * @brief Looks up the stored text profile of an unchanged file (of any
+ *        model version), read with the current read settings.
+ *
+ * @param identity Identity of the file
+ * @param profile Receives the normalized profile
+ * @param sampledFraction If not null, receives the fraction of the file
+ *                        read for the profile
+ * @return Whether a profile was stored
+ */
+bool DiskCache::getProfile(const FileIdentity &identity, TrigramProfile &profile, double *sampledFraction)
+{
+    lock_guard<mutex> guard(lock);
+
+    const Entry *entry = findEntry(identity);
+    if (!entry || entry->profile.empty() || entry->readSettings != readSettings)
+        return false;
+
+    if (sampledFraction)
+        *sampledFraction = entry->profileSampledFraction;
+
+    profile.clear();
+    profile.reserve(entry->profile.size());
+    for (const auto &[trigram, frequency] : entry->profile)
+        profile[trigram] = frequency;
+    return true;
+}
+
+/**
+ * @brief Stores the result of a file for the current model.
+ *
+ * @param identity Identity of the file
+ * @param guess The result
+ * @param sampledFraction Fraction of the file read for the result (and the
+ *                        profile)
+ * @param profile Optional normalized text profile, to rescore the file
+ *                without reading it when the model changes. If null, a
+ *                profile stored earlier for the same file is kept.
+ */
+void DiskCache::put(const FileIdentity &identity, const LanguageGuess &guess, double sampledFraction,
+                    const TrigramProfile *profile)
+{
+    lock_guard<mutex> guard(lock);
+
+    ProfileRows profileRows;
+    string profileReadSettings;
+    double profileSampledFraction = 0.0;
+    if (profile)
+    {
+        profileRows.assign(profile->begin(), profile->end());
+        profileReadSettings = readSettings;
+        profileSampledFraction = sampledFraction;
+    }
+    else if (const Entry *entry = findEntry(identity))
+    {
+        profileRows = entry->profile;
+        profileReadSettings = entry->readSettings;
+        profileSampledFraction = entry->profileSampledFraction;
+    }
+
+    Entry &entry = entries[make_pair(identity.device, identity.inode)];
+    entry.identity = identity;
+    entry.modelVersion = modelVersion;
+    entry.guess = guess;
+    entry.sampledFraction = sampledFraction;
+    entry.readSettings = move(profileReadSettings);
+    entry.profileSampledFraction = profileSampledFraction;
+    entry.profile = move(profileRows);
+    entry.isUsed = true;
+    isModified = true;
+}
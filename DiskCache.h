@@ -0,0 +1,96 @@
+/**
+ * @brief Lequel? persistent per-file cache of identification results
+ * @author Dylan Frigerio, Micaela Dinsen
+ *
+ * @copyright Copyright (c) 2022-2023
+ *
+ * Entries are keyed by file identity (device, inode, size and modification
+ * time) and hold the result for one model version and the fraction of the
+ * file read for it, plus optionally the file's normalized text profile and
+ * the read settings (bytes read, sample windows) it was built with. An unchanged file is answered without
+ * opening it; if only the model changed, its stored profile is rescored
+ * without reading the file, as long as it was read the same way. The whole
+ * cache is loaded by open() and written back atomically by save(), which
+ * drops the entries of files this run did not look up: a cache file serves
+ * one set of files (for instance, one nightly rescan), and deleted or
+ * replaced files do not stay in it.
+ */
+
+#ifndef DISKCACHE_H
+#define DISKCACHE_H
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "Lequel.h"
+
+// Cache file: "LQRC" magic, uint32 format version, uint32 TrigramPacking,
+// uint64 entry count, then the entries (see DiskCache::save)
+const char DISK_CACHE_MAGIC[4] = {'L', 'Q', 'R', 'C'};
+const uint32_t DISK_CACHE_VERSION = 3;
+
+// FileIdentity: what decides whether a file changed since it was cached
+struct FileIdentity
+{
+    uint64_t device;
+    uint64_t inode;
+    uint64_t size;
+    int64_t modificationTime; // ns since the epoch
+};
+
+bool getFileIdentity(const std::string &path, FileIdentity &identity);
+
+class DiskCache
+{
+public:
+    bool open(const std::string &path, uint64_t modelVersion, const std::string &readSettings);
+    bool save();
+
+    bool getResult(const FileIdentity &identity, LanguageGuess &guess, double *sampledFraction = nullptr);
+    bool getProfile(const FileIdentity &identity, TrigramProfile &profile, double *sampledFraction = nullptr);
+    void put(const FileIdentity &identity, const LanguageGuess &guess, double sampledFraction,
+             const TrigramProfile *profile = nullptr);
+
+    size_t getEntryCount() const { return entries.size(); }
+
+private:
+    // (trigram, normalized frequency) rows
+    typedef std::vector<std::pair<uint64_t, float>> ProfileRows;
+
+    struct Entry
+    {
+        FileIdentity identity;
+        uint64_t modelVersion;
+        LanguageGuess guess;
+        double sampledFraction;        // Fraction of the file read for the guess
+        std::string readSettings;      // How the profile was read
+        double profileSampledFraction; // Fraction of the file read for the profile
+        ProfileRows profile;
+        bool isUsed = false;      // Looked up by this run (not stored)
+    };
+
+    struct FileKeyHasher
+    {
+        size_t operator()(const std::pair<uint64_t, uint64_t> &key) const
+        {
+            return (size_t)(key.first * 0x9E3779B97F4A7C15 ^ key.second);
+        }
+    };
+
+    Entry *findEntry(const FileIdentity &identity);
+
+    std::string path;
+    uint64_t modelVersion = 0;
+    std::string readSettings;
+    bool isModified = false;
+    std::mutex lock;
+
+    // Keyed by (device, inode)
+    std::unordered_map<std::pair<uint64_t, uint64_t>, Entry, FileKeyHasher> entries;
+};
+
+#endif
@@ -0,0 +1,394 @@
+/**
+ * @brief Lequel? SIMD kernels with runtime CPU dispatch
+ * @author Dylan Frigerio, Micaela Dinsen
+ *
+ * @copyright Copyright (c) 2022-2023
+ *
+ * The vector versions are compiled with per-function target attributes, so
+ * this file needs no ISA flags and the rest of the engine stays generic.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "Kernels.h"
+#include "Lequel.h"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define LEQUEL_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+namespace
+{
+    // --- Scalar ---
+
+    size_t decodeAsciiScalar(const unsigned char *data, size_t size, char16_t *characters)
+    {
+        size_t i = 0;
+        for (; i < size; i++)
+        {
+            const unsigned char byte = data[i];
+            if (byte >= 0x80 || byte == '\n')
+                break;
+            characters[i] = (char16_t)(((unsigned)(byte - 'A') < 26u) ? byte + ('a' - 'A') : byte);
+        }
+        return i;
+    }
+
+    void packTrigramsScalar(const char32_t *codePoints, size_t count, uint64_t *trigrams)
+    {
+        for (size_t i = 0; i + 2 < count; i++)
+        {
+            trigrams[i] = ((uint64_t)codePoints[i] << (2 * TRIGRAM_CODEPOINT_BITS)) |
+                          ((uint64_t)codePoints[i + 1] << TRIGRAM_CODEPOINT_BITS) |
+                          (uint64_t)codePoints[i + 2];
+        }
+    }
+
+    double sumOfSquaresScalar(const uint32_t *counters, size_t count)
+    {
+        double sum = 0.0;
+        for (size_t i = 0; i < count; i++)
+            sum += (double)counters[i] * counters[i];
+        return sum;
+    }
+
+    float gatherDotScalar(const float *weights, const TrigramIdWeight *entries, size_t count)
+    {
+        float sum = 0.0f;
+        for (size_t i = 0; i < count; i++)
+            sum += weights[entries[i].id] * entries[i].weight;
+        return sum;
+    }
+
+#ifdef LEQUEL_X86_KERNELS
+    // --- SSE4.2 ---
+
+    __attribute__((target("sse4.2")))
+    size_t decodeAsciiSse42(const unsigned char *data, size_t size, char16_t *characters)
+    {
+        const __m128i newline = _mm_set1_epi8('\n');
+        const __m128i beforeA = _mm_set1_epi8('A' - 1);
+        const __m128i afterZ = _mm_set1_epi8('Z' + 1);
+        const __m128i caseBit = _mm_set1_epi8('a' - 'A');
+
+        size_t i = 0;
+        for (; i + 16 <= size; i += 16)
+        {
+            const __m128i bytes = _mm_loadu_si128((const __m128i *)(data + i));
+
+            // Bytes >= 0x80 are negative, so they are never uppercase
+            const __m128i isUpper = _mm_and_si128(_mm_cmpgt_epi8(bytes, beforeA), _mm_cmplt_epi8(bytes, afterZ));
+            const __m128i lower = _mm_add_epi8(bytes, _mm_and_si128(isUpper, caseBit));
+
+            _mm_storeu_si128((__m128i *)(characters + i), _mm_cvtepu8_epi16(lower));
+            _mm_storeu_si128((__m128i *)(characters + i + 8), _mm_cvtepu8_epi16(_mm_srli_si128(lower, 8)));
+
+            const unsigned stop = (unsigned)(_mm_movemask_epi8(bytes) | _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, newline)));
+            if (stop)
+                return i + __builtin_ctz(stop);
+        }
+        return i + decodeAsciiScalar(data + i, size - i, characters + i);
+    }
+
+    __attribute__((target("sse4.2")))
+    void packTrigramsSse42(const char32_t *codePoints, size_t count, uint64_t *trigrams)
+    {
+        size_t i = 0;
+        for (; i + 2 + 2 <= count; i += 2)
+        {
+            const __m128i c0 = _mm_cvtepu32_epi64(_mm_loadl_epi64((const __m128i *)(codePoints + i)));
+            const __m128i c1 = _mm_cvtepu32_epi64(_mm_loadl_epi64((const __m128i *)(codePoints + i + 1)));
+            const __m128i c2 = _mm_cvtepu32_epi64(_mm_loadl_epi64((const __m128i *)(codePoints + i + 2)));
+
+            const __m128i packed = _mm_or_si128(_mm_or_si128(_mm_slli_epi64(c0, 2 * TRIGRAM_CODEPOINT_BITS),
+                                                             _mm_slli_epi64(c1, TRIGRAM_CODEPOINT_BITS)), c2);
+            _mm_storeu_si128((__m128i *)(trigrams + i), packed);
+        }
+        packTrigramsScalar(codePoints + i, count - i, trigrams + i);
+    }
+
+    __attribute__((target("sse4.2")))
+    double sumOfSquaresSse42(const uint32_t *counters, size_t count)
+    {
+        // Unsigned to double: convert as signed, then undo the bias
+        const __m128i bias = _mm_set1_epi32(INT32_MIN);
+        const __m128d unbias = _mm_set1_pd(2147483648.0);
+
+        __m128d sum = _mm_setzero_pd();
+        size_t i = 0;
+        for (; i + 4 <= count; i += 4)
+        {
+            const __m128i values = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(counters + i)), bias);
+            const __m128d low = _mm_add_pd(_mm_cvtepi32_pd(values), unbias);
+            const __m128d high = _mm_add_pd(_mm_cvtepi32_pd(_mm_srli_si128(values, 8)), unbias);
+            sum = _mm_add_pd(sum, _mm_add_pd(_mm_mul_pd(low, low), _mm_mul_pd(high, high)));
+        }
+
+        double lanes[2];
+        _mm_storeu_pd(lanes, sum);
+        return lanes[0] + lanes[1] + sumOfSquaresScalar(counters + i, count - i);
+    }
+
+    __attribute__((target("sse4.2")))
+    float gatherDotSse42(const float *weights, const TrigramIdWeight *entries, size_t count)
+    {
+        // No gather instruction: load the weights one by one, multiply 4 at once
+        __m128 sum = _mm_setzero_ps();
+        size_t i = 0;
+        for (; i + 4 <= count; i += 4)
+        {
+            const __m128 textWeights = _mm_setr_ps(weights[entries[i].id], weights[entries[i + 1].id],
+                                                   weights[entries[i + 2].id], weights[entries[i + 3].id]);
+            const __m128 low = _mm_loadu_ps((const float *)(entries + i));
+            const __m128 high = _mm_loadu_ps((const float *)(entries + i + 2));
+            const __m128 entryWeights = _mm_shuffle_ps(low, high, _MM_SHUFFLE(3, 1, 3, 1));
+            sum = _mm_add_ps(sum, _mm_mul_ps(textWeights, entryWeights));
+        }
+
+        float lanes[4];
+        _mm_storeu_ps(lanes, sum);
+        return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]) + gatherDotScalar(weights, entries + i, count - i);
+    }
+
+    // --- AVX2 ---
+
+    __attribute__((target("avx2")))
+    size_t decodeAsciiAvx2(const unsigned char *data, size_t size, char16_t *characters)
+    {
+        const __m256i newline = _mm256_set1_epi8('\n');
+        const __m256i beforeA = _mm256_set1_epi8('A' - 1);
+        const __m256i lastUpper = _mm256_set1_epi8('Z');
+        const __m256i caseBit = _mm256_set1_epi8('a' - 'A');
+
+        size_t i = 0;
+        for (; i + 32 <= size; i += 32)
+        {
+            const __m256i bytes = _mm256_loadu_si256((const __m256i *)(data + i));
+
+            const __m256i isUpper = _mm256_andnot_si256(_mm256_cmpgt_epi8(bytes, lastUpper),
+                                                        _mm256_cmpgt_epi8(bytes, beforeA));
+            const __m256i lower = _mm256_add_epi8(bytes, _mm256_and_si256(isUpper, caseBit));
+
+            _mm256_storeu_si256((__m256i *)(characters + i), _mm256_cvtepu8_epi16(_mm256_castsi256_si128(lower)));
+            _mm256_storeu_si256((__m256i *)(characters + i + 16), _mm256_cvtepu8_epi16(_mm256_extracti128_si256(lower, 1)));
+
+            const unsigned stop = (unsigned)(_mm256_movemask_epi8(bytes) |
+                                             _mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, newline)));
+            if (stop)
+                return i + __builtin_ctz(stop);
+        }
+        return i + decodeAsciiSse42(data + i, size - i, characters + i);
+    }
+
+    __attribute__((target("avx2")))
+    void packTrigramsAvx2(const char32_t *codePoints, size_t count, uint64_t *trigrams)
+    {
+        size_t i = 0;
+        for (; i + 4 + 2 <= count; i += 4)
+        {
+            const __m256i c0 = _mm256_cvtepu32_epi64(_mm_loadu_si128((const __m128i *)(codePoints + i)));
+            const __m256i c1 = _mm256_cvtepu32_epi64(_mm_loadu_si128((const __m128i *)(codePoints + i + 1)));
+            const __m256i c2 = _mm256_cvtepu32_epi64(_mm_loadu_si128((const __m128i *)(codePoints + i + 2)));
+
+            const __m256i packed = _mm256_or_si256(_mm256_or_si256(_mm256_slli_epi64(c0, 2 * TRIGRAM_CODEPOINT_BITS),
+                                                                   _mm256_slli_epi64(c1, TRIGRAM_CODEPOINT_BITS)), c2);
+            _mm256_storeu_si256((__m256i *)(trigrams + i), packed);
+        }
+        packTrigramsScalar(codePoints + i, count - i, trigrams + i);
+    }
+
+    __attribute__((target("avx2")))
+    double sumOfSquaresAvx2(const uint32_t *counters, size_t count)
+    {
+        const __m128i bias = _mm_set1_epi32(INT32_MIN);
+        const __m256d unbias = _mm256_set1_pd(2147483648.0);
+
+        __m256d sum = _mm256_setzero_pd();
+        size_t i = 0;
+        for (; i + 4 <= count; i += 4)
+        {
+            const __m128i values = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(counters + i)), bias);
+            const __m256d converted = _mm256_add_pd(_mm256_cvtepi32_pd(values), unbias);
+            sum = _mm256_add_pd(sum, _mm256_mul_pd(converted, converted));
+        }
+
+        double lanes[4];
+        _mm256_storeu_pd(lanes, sum);
+        return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]) + sumOfSquaresScalar(counters + i, count - i);
+    }
+
+    __attribute__((target("avx2")))
+    float gatherDotAvx2(const float *weights, const TrigramIdWeight *entries, size_t count)
+    {
+        __m256 sum = _mm256_setzero_ps();
+        size_t i = 0;
+        for (; i + 8 <= count; i += 8)
+        {
+            // Split ids from weights; both come out in the same (shuffled) order
+            const __m256 low = _mm256_loadu_ps((const float *)(entries + i));
+            const __m256 high = _mm256_loadu_ps((const float *)(entries + i + 4));
+            const __m256i ids = _mm256_castps_si256(_mm256_shuffle_ps(low, high, _MM_SHUFFLE(2, 0, 2, 0)));
+            const __m256 entryWeights = _mm256_shuffle_ps(low, high, _MM_SHUFFLE(3, 1, 3, 1));
+
+            const __m256 textWeights = _mm256_i32gather_ps(weights, ids, sizeof(float));
+            sum = _mm256_add_ps(sum, _mm256_mul_ps(textWeights, entryWeights));
+        }
+
+        float lanes[8];
+        _mm256_storeu_ps(lanes, sum);
+        return ((lanes[0] + lanes[1]) + (lanes[2] + lanes[3])) + ((lanes[4] + lanes[5]) + (lanes[6] + lanes[7])) +
+               gatherDotScalar(weights, entries + i, count - i);
+    }
+
+    // --- AVX-512 (F + BW) ---
+
+    // GCC 12 warns about the _mm512_undefined_* placeholders inside its own
+    // intrinsics (GCC bug 105593)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+
+    __attribute__((target("avx512f,avx512bw")))
+    size_t decodeAsciiAvx512(const unsigned char *data, size_t size, char16_t *characters)
+    {
+        const __m512i newline = _mm512_set1_epi8('\n');
+        const __m512i firstUpper = _mm512_set1_epi8('A');
+        const __m512i caseBit = _mm512_set1_epi8('a' - 'A');
+        const __m512i upperRange = _mm512_set1_epi8('Z' - 'A');
+
+        size_t i = 0;
+        for (; i + 64 <= size; i += 64)
+        {
+            const __m512i bytes = _mm512_loadu_si512((const void *)(data + i));
+
+            const __mmask64 isUpper = _mm512_cmple_epu8_mask(_mm512_sub_epi8(bytes, firstUpper), upperRange);
+            const __m512i lower = _mm512_mask_add_epi8(bytes, isUpper, bytes, caseBit);
+
+            _mm512_storeu_si512((void *)(characters + i), _mm512_cvtepu8_epi16(_mm512_castsi512_si256(lower)));
+            _mm512_storeu_si512((void *)(characters + i + 32), _mm512_cvtepu8_epi16(_mm512_extracti64x4_epi64(lower, 1)));
+
+            const __mmask64 stop = _mm512_movepi8_mask(bytes) | _mm512_cmpeq_epi8_mask(bytes, newline);
+            if (stop)
+                return i + __builtin_ctzll(stop);
+        }
+        return i + decodeAsciiAvx2(data + i, size - i, characters + i);
+    }
+
+    __attribute__((target("avx512f")))
+    void packTrigramsAvx512(const char32_t *codePoints, size_t count, uint64_t *trigrams)
+    {
+        size_t i = 0;
+        for (; i + 8 + 2 <= count; i += 8)
+        {
+            const __m512i c0 = _mm512_cvtepu32_epi64(_mm256_loadu_si256((const __m256i *)(codePoints + i)));
+            const __m512i c1 = _mm512_cvtepu32_epi64(_mm256_loadu_si256((const __m256i *)(codePoints + i + 1)));
+            const __m512i c2 = _mm512_cvtepu32_epi64(_mm256_loadu_si256((const __m256i *)(codePoints + i + 2)));
+
+            const __m512i packed = _mm512_or_si512(_mm512_or_si512(_mm512_slli_epi64(c0, 2 * TRIGRAM_CODEPOINT_BITS),
+                                                                   _mm512_slli_epi64(c1, TRIGRAM_CODEPOINT_BITS)), c2);
+            _mm512_storeu_si512((void *)(trigrams + i), packed);
+        }
+        packTrigramsAvx2(codePoints + i, count - i, trigrams + i);
+    }
+
+    __attribute__((target("avx512f")))
+    double sumOfSquaresAvx512(const uint32_t *counters, size_t count)
+    {
+        __m512d sum = _mm512_setzero_pd();
+        size_t i = 0;
+        for (; i + 8 <= count; i += 8)
+        {
+            const __m512d converted = _mm512_cvtepu32_pd(_mm256_loadu_si256((const __m256i *)(counters + i)));
+            sum = _mm512_add_pd(sum, _mm512_mul_pd(converted, converted));
+        }
+        return _mm512_reduce_add_pd(sum) + sumOfSquaresScalar(counters + i, count - i);
+    }
+
+    __attribute__((target("avx512f")))
+    float gatherDotAvx512(const float *weights, const TrigramIdWeight *entries, size_t count)
+    {
+        const __m512i idLanes = _mm512_setr_epi32(0, 2, 4, 6, 8, 10, 12, 14, 16, 18, 20, 22, 24, 26, 28, 30);
+        const __m512i weightLanes = _mm512_add_epi32(idLanes, _mm512_set1_epi32(1));
+
+        __m512 sum = _mm512_setzero_ps();
+        size_t i = 0;
+        for (; i + 16 <= count; i += 16)
+        {
+            const __m512i low = _mm512_loadu_si512((const void *)(entries + i));
+            const __m512i high = _mm512_loadu_si512((const void *)(entries + i + 8));
+            const __m512i ids = _mm512_permutex2var_epi32(low, idLanes, high);
+            const __m512 entryWeights = _mm512_castsi512_ps(_mm512_permutex2var_epi32(low, weightLanes, high));
+
+            const __m512 textWeights = _mm512_i32gather_ps(ids, weights, sizeof(float));
+            sum = _mm512_add_ps(sum, _mm512_mul_ps(textWeights, entryWeights));
+        }
+        return _mm512_reduce_add_ps(sum) + gatherDotAvx2(weights, entries + i, count - i);
+    }
+#pragma GCC diagnostic pop
+#endif
+
+    const Kernels KERNELS[] = {
+        {KernelIsa::SCALAR, "scalar", decodeAsciiScalar, packTrigramsScalar, sumOfSquaresScalar, gatherDotScalar},
+#ifdef LEQUEL_X86_KERNELS
+        {KernelIsa::SSE42, "sse4.2", decodeAsciiSse42, packTrigramsSse42, sumOfSquaresSse42, gatherDotSse42},
+        {KernelIsa::AVX2, "avx2", decodeAsciiAvx2, packTrigramsAvx2, sumOfSquaresAvx2, gatherDotAvx2},
+        {KernelIsa::AVX512, "avx512", decodeAsciiAvx512, packTrigramsAvx512, sumOfSquaresAvx512, gatherDotAvx512},
+#endif
+    };
+    const size_t KERNELS_NUM = sizeof(KERNELS) / sizeof(KERNELS[0]);
+
+    /**
+     * @brief Finds the best kernels the CPU runs.
+     */
+    size_t getSupportedKernels()
+    {
+        size_t best = 0;
+#ifdef LEQUEL_X86_KERNELS
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("sse4.2"))
+            best = 1;
+        if (best == 1 && __builtin_cpu_supports("avx2"))
+            best = 2;
+        if (best == 2 && __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw"))
+            best = 3;
+#endif
+        return best;
+    }
+
+    const Kernels &selectKernels()
+    {
+        size_t selected = getSupportedKernels();
+
+        const char *requestedName = getenv("LEQUEL_ISA");
+        if (requestedName && *requestedName)
+        {
+            size_t requested = 0;
+            while (requested < KERNELS_NUM && strcmp(KERNELS[requested].name, requestedName))
+                requested++;
+
+            if (requested == KERNELS_NUM)
+                fprintf(stderr, "LEQUEL_ISA: unknown instruction set %s, using %s\n",
+                        requestedName, KERNELS[selected].name);
+            else if (requested > selected)
+                fprintf(stderr, "LEQUEL_ISA: %s is not supported by this CPU, using %s\n",
+                        requestedName, KERNELS[selected].name);
+            else
+                selected = requested;
+        }
+        return KERNELS[selected];
+    }
+}
+
+/**
+ * @brief Returns the kernels for this CPU (selected on the first call).
+ */
+const Kernels &getKernels()
+{
+    static const Kernels &kernels = selectKernels();
+    return kernels;
+}
@@ -0,0 +1,57 @@
+/**
+ * @brief Lequel? SIMD kernels with runtime CPU dispatch
+ * @author Dylan Frigerio, Micaela Dinsen
+ *
+ * @copyright Copyright (c) 2022-2023
+ *
+ * Every kernel has a scalar, SSE4.2, AVX2 and AVX-512 version in one binary;
+ * getKernels() picks the best one the CPU supports the first time it is
+ * called. The LEQUEL_ISA environment variable (scalar, sse4.2, avx2 or
+ * avx512) forces a lower one, to test each path on a single machine.
+ *
+ * gatherDot scores a language against a text profile spread by trigram id
+ * (see forEachSimilarity in Lequel.cpp). Trigram counting has no kernel. It is bound by scattered increments,
+ * and vector digit histograms lost on the diverse texts that reach the
+ * radix sort.
+ */
+
+#ifndef KERNELS_H
+#define KERNELS_H
+
+#include <cstddef>
+#include <cstdint>
+
+struct TrigramIdWeight;
+
+enum class KernelIsa
+{
+    SCALAR,
+    SSE42,
+    AVX2,
+    AVX512,
+};
+
+struct Kernels
+{
+    KernelIsa isa;
+    const char *name;
+
+    // Lowercases and widens the leading ASCII bytes of data into characters,
+    // up to the first non-ASCII byte or '\n'. characters must have room for
+    // size units. Returns the number of bytes decoded.
+    size_t (*decodeAscii)(const unsigned char *data, size_t size, char16_t *characters);
+
+    // Packs the count - 2 trigrams of count code points (count >= 3)
+    void (*packTrigrams)(const char32_t *codePoints, size_t count, uint64_t *trigrams);
+
+    // Sum of the squares of some counters (the norm of a count-min sketch row)
+    double (*sumOfSquares)(const uint32_t *counters, size_t count);
+
+    // Dot product of (id, weight) entries with an array of weights by id:
+    // the sum of weights[entry.id] * entry.weight
+    float (*gatherDot)(const float *weights, const TrigramIdWeight *entries, size_t count);
+};
+
+const Kernels &getKernels();
+
+#endif
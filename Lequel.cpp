@@ -10,66 +10,594 @@
 
 #include <cmath>
 #include <codecvt>
+#include <cstring>
 #include <locale>
 #include <iostream>
 #include <algorithm>
+#include <vector>
 #include "Lequel.h"
+#include "Kernels.h"
+#include "Metrics.h"
+#include "PerfCounters.h"
+#include "Probes.h"
+#include "ResultCache.h"
+#include "ThreadPool.h"
+#include "Trace.h"
+#include "TrigramVocabulary.h"
 
 using namespace std;
 
 namespace {
     /**
-     * @brief Extracts and counts trigrams from a single line of UTF-8 text.
-     * @param line Input string (UTF-8 encoded)
-     * @param trigrams Destination trigram profile
+     * @brief Decodes the code point starting at data[i] and advances i past it.
+     *
+     * Unpaired surrogates are returned as they are.
      */
-    inline void extractTrigramsFromLine(const wstring& line, TrigramProfile& trigrams) {
+    inline char32_t decodeCodePoint(const char16_t* data, size_t len, size_t& i) noexcept {
+        char32_t c = data[i++];
+        if ((c & 0xFC00) == 0xD800 && i < len && (data[i] & 0xFC00) == 0xDC00) {
+            c = 0x10000 + ((c - 0xD800) << 10) + (data[i++] - 0xDC00);
+        }
+        return c;
+    }
+
+    // Code points packed per kernel call
+    const size_t TRIGRAM_BLOCK_SIZE = 256;
+
+    /**
+     * @brief Calls visit(trigram) for every trigram of a single line of text.
+     *
+     * Trigrams are made of code points, so a surrogate pair counts as a
+     * single character.
+     *
+     * @param line Input line (UTF-16 encoded), read in place from the Text buffer
+     * @param visit Called with each packed trigram
+     */
+    template <typename Visitor>
+    inline void forEachTrigramInLine(u16string_view line, Visitor&& visit) {
         const size_t len = line.length();
         if (len < 3) return;
 
-        const wchar_t* data = line.data();
+        const char16_t* data = line.data();
+        const Kernels& kernels = getKernels();
 
-        // Process trigrams in chunks to improve cache locality
-        for (size_t i = 0; i <= len - 3; ++i) {
-            // Inline the trigram packing for better performance
-            const uint64_t trigram = (uint64_t(data[i]) << 32) |
-                                     (uint64_t(data[i + 1]) << 16) |
-                                      uint64_t(data[i + 2]);
+        // Decode a block of code points, pack all its trigrams at once and
+        // carry the last two code points over to the next block
+        char32_t codePoints[TRIGRAM_BLOCK_SIZE + 2];
+        uint64_t trigrams[TRIGRAM_BLOCK_SIZE];
+        size_t count = 0;
 
-            // Quick validation - check if any character is null or carriage return/newline
-            if (trigram != 0) {
-                ++trigrams[trigram];
+        size_t i = 0;
+        while (i < len) {
+            while (count < TRIGRAM_BLOCK_SIZE + 2 && i < len) {
+                codePoints[count++] = decodeCodePoint(data, len, i);
             }
+            if (count < 3) return;
+
+            kernels.packTrigrams(codePoints, count, trigrams);
+            for (size_t j = 0; j < count - 2; j++) {
+                // Quick validation - skip trigrams made only of null characters
+                if (trigrams[j] != 0) {
+                    visit(trigrams[j]);
+                }
+            }
+
+            codePoints[0] = codePoints[count - 2];
+            codePoints[1] = codePoints[count - 1];
+            count = 2;
         }
     }
 
+    /**
+     * @brief Extracts and counts trigrams from a single line of text.
+     *
+     * @param line Input line (UTF-16 encoded), read in place from the Text buffer
+     * @param trigrams Destination trigram profile (or counts)
+     * @return size_t The number of trigrams counted
+     */
+    template <typename Profile>
+    inline size_t extractTrigramsFromLine(u16string_view line, Profile& trigrams) {
+        size_t count = 0;
+        forEachTrigramInLine(line, [&](uint64_t trigram) {
+            ++trigrams[trigram];
+            count++;
+        });
+        return count;
+    }
+
     /**
      * @brief Computes Euclidean norm of a trigram profile (for normalization).
      */
-    inline float calculateNorm(const TrigramProfile& profile) noexcept {
+    template <typename Profile>
+    inline float calculateNorm(const Profile& profile) noexcept {
         float norm_sq = 0.0f;
         for (const auto& [key, value] : profile) {
             norm_sq += value * value;
         }
         return sqrt(norm_sq);
     }
+
+    // Count-min sketch of the trigrams missing from the model: rows of
+    // counters, each row indexed by its own multiplicative hash
+    const int SKETCH_ROW_NUM = 4;
+    const int SKETCH_WIDTH_BITS = 14;
+    const uint64_t SKETCH_SEEDS[SKETCH_ROW_NUM] = {
+        0x9E3779B97F4A7C15, 0xC2B2AE3D27D4EB4F, 0x165667B19E3779F9, 0xD6E8FEB86659FD93,
+    };
+
+    inline size_t getSketchIndex(uint64_t trigram, int row) noexcept {
+        return ((size_t)row << SKETCH_WIDTH_BITS) + (size_t)((trigram * SKETCH_SEEDS[row]) >> (64 - SKETCH_WIDTH_BITS));
+    }
+
+    // Texts shorter than this are profiled serially: splitting them costs
+    // more than it saves
+    const size_t PARALLEL_PROFILE_MIN_CHARACTERS = 1 << 20;
+
+    // Shards per pool thread, so a slow thread does not hold up the others
+    const size_t PARALLEL_PROFILE_SHARDS_PER_THREAD = 4;
+
+    // Texts up to this size are profiled by sorting their trigrams: scoring a
+    // sorted profile with merge joins beats a hash lookup per trigram and
+    // language
+    const size_t SORTED_PROFILE_SMALL_CHARACTERS = 1 << 15;
+
+    // Dense counting: the DENSE_SYMBOL_NUM - 1 most frequent characters of a
+    // text get a 6-bit symbol (all others share DENSE_OTHER_SYMBOL), so a
+    // trigram of symbols indexes an array of 64^3 counters directly
+    const int DENSE_SYMBOL_BITS = 6;
+    const size_t DENSE_SYMBOL_NUM = (size_t)1 << DENSE_SYMBOL_BITS;
+    const uint8_t DENSE_OTHER_SYMBOL = DENSE_SYMBOL_NUM - 1;
+    const size_t DENSE_COUNTER_NUM = (size_t)1 << (3 * DENSE_SYMBOL_BITS);
+
+    // Only characters below this can get a symbol (every alphabetic script,
+    // but no CJK ideographs or Hangul syllables)
+    const size_t DENSE_TABLE_SIZE = 1 << 14;
+
+    // The alphabet is chosen from the first characters of the text, and used
+    // only if it covers this fraction of them
+    const size_t DENSE_SAMPLE_SIZE = 1 << 16;
+    const double DENSE_MIN_COVERAGE = 0.95;
+
+    // Below this, clearing and scanning the counters costs more than counting
+    const size_t DENSE_PROFILE_MIN_CHARACTERS = 1 << 14;
+
+    // Larger texts are sorted only if they are diverse, since a hash map of a
+    // few thousand trigrams stays in the caches and counts faster. Diversity
+    // (distinct trigrams per trigram) is estimated on the first trigrams.
+    const size_t DIVERSITY_SAMPLE_SIZE = 1 << 14;
+    const int DIVERSITY_BITMAP_BITS = 16;
+    const double SORTED_PROFILE_MIN_DIVERSITY = 0.3;
+
+    // LSD radix sort of packed trigrams: each 21-bit code point is split into
+    // an 11-bit and a 10-bit digit, so every code point below U+0800 (Latin,
+    // Greek, Cyrillic, Arabic, Hebrew...) leaves its high digit constant
+    const int RADIX_LOW_DIGIT_BITS = 11;
+    const int RADIX_DIGIT_NUM = 6;
+    const size_t RADIX_BUCKET_NUM = (size_t)1 << RADIX_LOW_DIGIT_BITS;
+
+    inline int getRadixShift(int digit) noexcept {
+        return (digit / 2) * TRIGRAM_CODEPOINT_BITS + (digit % 2) * RADIX_LOW_DIGIT_BITS;
+    }
+
+    inline uint64_t getRadixMask(int digit) noexcept {
+        const int bits = (digit % 2) ? TRIGRAM_CODEPOINT_BITS - RADIX_LOW_DIGIT_BITS : RADIX_LOW_DIGIT_BITS;
+        return ((uint64_t)1 << bits) - 1;
+    }
+
+    /**
+     * @brief Whether buildTrigramProfile with a pool splits the text among
+     *        its threads.
+     */
+    inline bool isParallelProfile(const Text& text, const ThreadPool& pool) {
+        return text.characters.size() >= PARALLEL_PROFILE_MIN_CHARACTERS &&
+               pool.getThreadCount() >= 2 && ThreadPool::getCurrentWorker() < 0;
+    }
+
+    /**
+     * @brief Estimates the distinct trigrams per trigram at the start of a
+     *        text, by linear counting: each trigram sets one bit of a bitmap,
+     *        and the fraction of bits left clear gives the distinct count.
+     */
+    double estimateDiversity(const Text& text) {
+        uint64_t bitmap[((size_t)1 << DIVERSITY_BITMAP_BITS) / 64] = {};
+        size_t sampleSize = 0;
+
+        for (const u16string_view line : text) {
+            if (sampleSize >= DIVERSITY_SAMPLE_SIZE)
+                break;
+
+            // A huge single line is only read up to the sample size
+            forEachTrigramInLine(line.substr(0, DIVERSITY_SAMPLE_SIZE - sampleSize + 2), [&](uint64_t trigram) {
+                const size_t bit = (size_t)((trigram * SKETCH_SEEDS[0]) >> (64 - DIVERSITY_BITMAP_BITS));
+                bitmap[bit / 64] |= uint64_t(1) << (bit % 64);
+                sampleSize++;
+            });
+        }
+        if (!sampleSize)
+            return 0.0;
+
+        size_t setBits = 0;
+        for (const uint64_t word : bitmap) {
+            setBits += __builtin_popcountll(word);
+        }
+
+        const double bitNum = (double)((size_t)1 << DIVERSITY_BITMAP_BITS);
+        const double clearFraction = max(bitNum - setBits, 1.0) / bitNum;
+        return min(-bitNum * log(clearFraction) / sampleSize, 1.0);
+    }
+
+    /**
+     * @brief Appends each run of equal trigrams of a sorted list to a sorted
+     *        profile, as the trigram and its count.
+     */
+    void appendTrigramRuns(const TrigramList& sortedTrigrams, SortedTrigramProfile& trigrams) {
+        for (size_t i = 0; i < sortedTrigrams.size();) {
+            size_t end = i + 1;
+            while (end < sortedTrigrams.size() && sortedTrigrams[end] == sortedTrigrams[i])
+                end++;
+
+            trigrams.push_back({ sortedTrigrams[i], (float)(end - i) });
+            i = end;
+        }
+    }
+
+    /**
+     * @brief Whether a text is profiled by sorting its trigrams rather than
+     *        by counting them in a hash map.
+     */
+    inline bool isSortedProfile(const Text& text) {
+        return text.characters.size() <= SORTED_PROFILE_SMALL_CHARACTERS ||
+               estimateDiversity(text) >= SORTED_PROFILE_MIN_DIVERSITY;
+    }
+
+    /**
+     * @brief Moves a shard boundary off the second half of a surrogate pair.
+     */
+    inline size_t alignToCodePoint(const char16_t* data, size_t size, size_t position) noexcept {
+        if (position > 0 && position < size &&
+            (data[position] & 0xFC00) == 0xDC00 && (data[position - 1] & 0xFC00) == 0xD800) {
+            position++;
+        }
+        return position;
+    }
+
+    /**
+     * @brief Counts the trigrams that start in characters [begin, end) of a text.
+     *
+     * A trigram belongs to the shard where its first code point is, so the
+     * window reads up to two code points past the end of the shard (but
+     * never past the end of the line). Trigrams spanning two shards are
+     * then counted exactly once.
+     *
+     * @return uint64_t The number of trigrams counted
+     */
+    uint64_t countShardTrigrams(const Text& text, size_t begin, size_t end, TrigramCounts& counts) {
+        TRACE_SCOPE("count shard");
+        PerfScope perfScope(PerfStage::Profile);
+        const char16_t* data = text.characters.data();
+        const pmr::vector<size_t>& lineOffsets = text.lineOffsets;
+
+        // First line that ends after begin
+        size_t line = upper_bound(lineOffsets.begin(), lineOffsets.end(), begin) - lineOffsets.begin();
+        line = (line > 0) ? line - 1 : 0;
+
+        uint64_t trigramCount = 0;
+        for (; line < text.getLineCount() && lineOffsets[line] < end; line++) {
+            const size_t lineEnd = lineOffsets[line + 1];
+            const size_t start = max(lineOffsets[line], begin);
+            size_t stop = min(lineEnd, end);
+            if (start >= stop)
+                continue;
+
+            // Extend the window by the last two code points of the trigrams
+            for (int i = 0; i < 2 && stop < lineEnd; i++) {
+                decodeCodePoint(data, lineEnd, stop);
+            }
+            if (stop - start >= 3) {
+                trigramCount += extractTrigramsFromLine(u16string_view(data + start, stop - start), counts);
+            }
+        }
+        return trigramCount;
+    }
+}
+
+namespace {
+    // Minimum similarity to consider a match
+    const float SIMILARITY_THRESHOLD = 0.01f;
+
+    // Progressive identification: the first chunk is small so that a guess
+    // shows up within milliseconds; later ones double, so rescoring stays cheap
+    const size_t PROGRESS_FIRST_CHUNK_SIZE = 1 << 16;
+    const size_t PROGRESS_MAX_CHUNK_SIZE = 1 << 22;
+
+    inline const LanguageProfile& getLanguageProfile(const LanguageProfile& language) {
+        return language;
+    }
+
+    inline const LanguageProfile& getLanguageProfile(const LanguageProfile* language) {
+        return *language;
+    }
+
+    // Scoring a dense text profile costs a pass over the vocabulary (to clear
+    // it) plus one gather per language entry; the merge join costs about this
+    // many of those per text id and language
+    const size_t DENSE_SCORE_COST_RATIO = 32;
+
+    /**
+     * @brief Computes the similarity of a text profile (by id) to each
+     *        language, as a merge join or, when the text is large enough to
+     *        pay for it, by gathering from a dense copy of the text profile.
+     *
+     * @param textWeights Scratch array for the dense copy, reused across calls
+     * @param visit Called with each language profile and its similarity
+     */
+    template <typename Languages, typename Visitor>
+    void forEachSimilarity(const TrigramIdProfile& textIds, DenseTrigramIdProfile& textWeights,
+                           const Languages& languages, Visitor&& visit) {
+        size_t languageEntryNum = 0;
+        for (const auto& language : languages) {
+            languageEntryNum += getLanguageProfile(language).idProfile.size();
+        }
+
+        const size_t vocabularySize = getTrigramVocabulary().size();
+        if (textIds.size() * languages.size() * DENSE_SCORE_COST_RATIO < vocabularySize + languageEntryNum) {
+            for (const auto& language : languages) {
+                const LanguageProfile& langProfile = getLanguageProfile(language);
+                TRACE_SCOPE("score language", langProfile.languageCode);
+                visit(langProfile, getCosineSimilarity(textIds, langProfile.idProfile));
+            }
+            return;
+        }
+
+        textWeights.assign(vocabularySize, 0.0f);
+        for (const TrigramIdWeight& entry : textIds) {
+            textWeights[entry.id] = entry.weight;
+        }
+        for (const auto& language : languages) {
+            const LanguageProfile& langProfile = getLanguageProfile(language);
+            TRACE_SCOPE("score language", langProfile.languageCode);
+            visit(langProfile, getCosineSimilarity(textWeights, langProfile.idProfile));
+        }
+    }
+
+    /**
+     * @brief Scores a normalized text profile (hashed or sorted) against some
+     *        languages (profiles or pointers to them).
+     *
+     * The text profile is mapped to vocabulary ids once, so every language
+     * costs a merge join of ids or a gather (see forEachSimilarity).
+     */
+    template <typename Profile, typename Languages>
+    LanguageGuess scoreProfile(const Profile& textTrigrams, const Languages& languages) {
+        const LanguageGuess unknownGuess = { "unknown", 0.0f, 0.0f };
+
+        float maxSimilarity = -1.0f;
+        float secondSimilarity = -1.0f;
+        const string* bestLanguageCode = nullptr;
+
+        {
+            MetricTimer timer(MetricHistogram::ScoreLatency);
+            PerfScope perfScope(PerfStage::Score);
+            TRACE_SCOPE("score");
+            TrigramIdProfile textIds(textTrigrams.get_allocator().resource());
+            {
+                TRACE_SCOPE("map trigram ids");
+                getTrigramVocabulary().lookup(textTrigrams, textIds);
+            }
+
+            size_t languageIndex = 0;
+            DenseTrigramIdProfile textWeights(textTrigrams.get_allocator().resource());
+            forEachSimilarity(textIds, textWeights, languages, [&](const LanguageProfile& langProfile, float similarity) {
+                LEQUEL_PROBE3(language_scored, languageIndex, langProfile.languageCode.c_str(),
+                              getProbeSimilarity(similarity));
+                languageIndex++;
+
+                if (similarity > maxSimilarity) {
+                    secondSimilarity = maxSimilarity;
+                    maxSimilarity = similarity;
+                    bestLanguageCode = &langProfile.languageCode;
+                }
+                else if (similarity > secondSimilarity) {
+                    secondSimilarity = similarity;
+                }
+            });
+        }
+        if (secondSimilarity >= 0.0f) {
+            recordMetric(MetricHistogram::ScoreMargin,
+                         (uint64_t)((maxSimilarity - secondSimilarity) * 1e6f));
+        }
+        if (maxSimilarity > SIMILARITY_THRESHOLD && bestLanguageCode != nullptr) {
+            return { *bestLanguageCode, maxSimilarity, maxSimilarity - max(secondSimilarity, 0.0f) };
+        }
+        return unknownGuess;
+    }
+
+    /**
+     * @brief Scores a profile of raw counts (dividing by its norm instead of
+     *        normalizing it) and keeps the best languages, most likely first.
+     *
+     * @param countIds Scratch profile by id, reused across calls
+     * @param countWeights Scratch dense profile, reused across calls
+     * @return size_t Number of guesses stored (at most guessNum)
+     */
+    size_t getTopGuesses(const TrigramProfile& counts, float norm, const LanguageProfiles& languages,
+                         TrigramIdProfile& countIds, DenseTrigramIdProfile& countWeights,
+                         LanguageGuess* guesses, size_t guessNum) {
+        if (counts.empty() || norm <= 0.0f)
+            return 0;
+
+        getTrigramVocabulary().lookup(counts, countIds);
+
+        vector<pair<float, const string*>> similarities;
+        similarities.reserve(languages.size());
+        forEachSimilarity(countIds, countWeights, languages, [&](const LanguageProfile& language, float similarity) {
+            similarities.emplace_back(similarity / norm, &language.languageCode);
+            LEQUEL_PROBE3(language_scored, similarities.size() - 1, language.languageCode.c_str(),
+                          getProbeSimilarity(similarities.back().first));
+        });
+
+        // One more than reported, for the margin of the last one
+        const size_t rankedNum = min(guessNum + 1, similarities.size());
+        partial_sort(similarities.begin(), similarities.begin() + rankedNum, similarities.end(),
+                     [](const auto& a, const auto& b) { return a.first > b.first; });
+
+        const size_t reportedNum = min(guessNum, similarities.size());
+        for (size_t i = 0; i < reportedNum; i++) {
+            const float nextSimilarity = (i + 1 < rankedNum) ? max(similarities[i + 1].first, 0.0f) : 0.0f;
+            guesses[i] = { *similarities[i].second, similarities[i].first,
+                           similarities[i].first - nextSimilarity };
+        }
+        return reportedNum;
+    }
+
+    /**
+     * @brief Records the statistics of a text profile, normalizes it and
+     *        scores it against some languages.
+     *
+     * @param norm The norm of the complete profile (when the profile holds
+     *             only part of it), or 0 to compute it
+     */
+    template <typename Profile, typename Languages>
+    LanguageGuess scoreTextProfile(Profile& textTrigrams, uint64_t trigramCount, float norm,
+                                   uint64_t profileStartTime, const Languages& languages) {
+        const LanguageGuess unknownGuess = { "unknown", 0.0f, 0.0f };
+
+        if (textTrigrams.empty()) {
+            return unknownGuess;
+        }
+
+        addMetric(MetricCounter::TrigramsCounted, trigramCount);
+        recordMetric(MetricHistogram::ProfileSize, textTrigrams.size());
+        LEQUEL_PROBE3(profile_built, textTrigrams.size(), trigramCount, getProbeDuration(profileStartTime));
+
+        {
+            MetricTimer timer(MetricHistogram::NormalizeLatency);
+            PerfScope perfScope(PerfStage::Normalize);
+            TRACE_SCOPE("normalize");
+            if (norm > 0.0f)
+                normalizeTrigramProfile(textTrigrams, norm);
+            else
+                normalizeTrigramProfile(textTrigrams);
+        }
+
+        return scoreProfile(textTrigrams, languages);
+    }
+
+    /**
+     * @brief Scores a text against some languages (profiles or pointers to them).
+     */
+    template <typename Languages>
+    LanguageGuess scoreLanguages(const Text& text, const Languages& languages, Workspace& workspace,
+                                 const IdentifyOptions& options) {
+        const LanguageGuess unknownGuess = { "unknown", 0.0f, 0.0f };
+
+        if (text.empty() || languages.empty()) {
+            return unknownGuess;
+        }
+
+        addMetric(MetricCounter::DocumentsProcessed);
+
+        Workspace::Scope scope(workspace);
+        uint64_t trigramCount = 0;
+        const uint64_t profileStartTime = LEQUEL_PROBE_TIME(profile_built);
+
+        TrigramProfile textTrigrams(workspace.getResource());
+        SortedTrigramProfile sortedTrigrams(workspace.getResource());
+        bool isSorted = false;
+        float norm = 0.0f;
+        {
+            MetricTimer timer(MetricHistogram::ProfileLatency);
+            PerfScope perfScope(PerfStage::Profile);
+            if (options.modelTrigrams) {
+                norm = buildBoundedTrigramProfile(text, *options.modelTrigrams, textTrigrams, &trigramCount);
+            }
+            else if (options.pool && isParallelProfile(text, *options.pool)) {
+                buildTrigramProfile(text, textTrigrams, *options.pool, &trigramCount);
+            }
+            else if (text.characters.size() >= DENSE_PROFILE_MIN_CHARACTERS &&
+                     buildDenseTrigramProfile(text, sortedTrigrams, &trigramCount)) {
+                isSorted = true;
+            }
+            else if (isSortedProfile(text)) {
+                buildSortedTrigramProfile(text, sortedTrigrams, &trigramCount);
+                isSorted = true;
+            }
+            else {
+                buildTrigramProfile(text, textTrigrams, &trigramCount);
+            }
+        }
+        if (isSorted) {
+            return scoreTextProfile(sortedTrigrams, trigramCount, 0.0f, profileStartTime, languages);
+        }
+        return scoreTextProfile(textTrigrams, trigramCount, norm, profileStartTime, languages);
+    }
+
+    /**
+     * @brief Scores a text, or returns its cached result.
+     */
+    template <typename Languages>
+    LanguageGuess guessLanguageAmong(const Text& text, const Languages& languages, Workspace& workspace,
+                                     const IdentifyOptions& options) {
+        TRACE_SCOPE("identify");
+        const uint64_t startTime = LEQUEL_PROBE_TIME(document_end);
+        LEQUEL_PROBE2(document_start, text.characters.size(), text.getLineCount());
+
+        LanguageGuess guess;
+        bool isCacheHit = false;
+        if (!options.cache || text.empty() || languages.empty()) {
+            guess = scoreLanguages(text, languages, workspace, options);
+        }
+        else {
+            TextHash key;
+            {
+                TRACE_SCOPE("hash text");
+                key = hashText(text);
+            }
+            isCacheHit = options.cache->get(key, guess);
+            if (!isCacheHit) {
+                guess = scoreLanguages(text, languages, workspace, options);
+                options.cache->put(key, guess);
+            }
+        }
+
+        LEQUEL_PROBE5(document_end, text.characters.size(), getProbeDuration(startTime),
+                      guess.languageCode.c_str(), getProbeSimilarity(guess.similarity), (int)isCacheHit);
+        return guess;
+    }
 }
 
 /**
  * @brief Builds a trigram profile from full text.
- * @param text Vector of text lines
+ * @param text Text lines
  */
 TrigramProfile buildTrigramProfile(const Text& text) {
-    if (text.empty())
-        return {};
-
     TrigramProfile trigrams;
+    buildTrigramProfile(text, trigrams);
+    return trigrams;
+}
+
+/**
+ * @brief Counts the trigrams of a text into an existing profile.
+ *
+ * The profile keeps its own memory resource, so a profile created on a
+ * Workspace is filled without touching the heap.
+ *
+ * @param text Text lines
+ * @param trigrams Destination trigram profile
+ * @param trigramCount If not null, receives the number of trigrams counted
+ */
+void buildTrigramProfile(const Text& text, TrigramProfile& trigrams, uint64_t* trigramCount) {
+    TRACE_SCOPE("extract trigrams");
+    if (trigramCount)
+        *trigramCount = 0;
+    if (text.empty())
+        return;
 
     // Preallocate to reduce reallocations
     size_t totalChars = 0;
     size_t validLines = 0;
 
-    for (const auto& line : text) {
+    for (const u16string_view line : text) {
         const size_t lineLen = line.length();
         if (lineLen >= 3) {
             totalChars += lineLen;
@@ -83,16 +611,437 @@ TrigramProfile buildTrigramProfile(const Text& text) {
 
     trigrams.reserve(uniqueTrigramsEstimate);
 
-    for (const auto& line : text) {
+    uint64_t count = 0;
+    for (const u16string_view line : text) {
         if (line.length() >= 3) {
-            extractTrigramsFromLine(line, trigrams);
+            count += extractTrigramsFromLine(line, trigrams);
         }
     }
+    if (trigramCount)
+        *trigramCount = count;
+}
 
-    // adjust the hashmap to actual size
-    trigrams.rehash(trigrams.size());
+/**
+ * @brief Adds the exact trigram counts of a text to existing counts.
+ * @param text Text lines
+ * @param counts Destination trigram counts
+ */
+void countTrigrams(const Text& text, TrigramCounts& counts) {
+    TRACE_SCOPE("count trigrams");
+    for (const u16string_view line : text) {
+        if (line.length() >= 3) {
+            extractTrigramsFromLine(line, counts);
+        }
+    }
+}
 
-    return trigrams;
+/**
+ * @brief Adds the exact trigram counts of a text to existing counts, with
+ *        every pool thread.
+ *
+ * The text is split into shards of about the same number of characters (at
+ * code point boundaries, so a single huge line is split too). Each thread
+ * counts its shards into its own map and the maps are then merged in pairs.
+ * Must not be called from a pool thread.
+ *
+ * @param text Text lines
+ * @param counts Destination trigram counts
+ * @param pool Thread pool
+ * @param trigramCount If not null, receives the number of trigrams counted
+ */
+void countTrigrams(const Text& text, TrigramCounts& counts, ThreadPool& pool, uint64_t* trigramCount) {
+    const char16_t* data = text.characters.data();
+    const size_t size = text.characters.size();
+    if (trigramCount)
+        *trigramCount = 0;
+    if (!size)
+        return;
+
+    const size_t shardNum = min(size, (size_t)pool.getThreadCount() * PARALLEL_PROFILE_SHARDS_PER_THREAD);
+    vector<size_t> bounds(shardNum + 1);
+    for (size_t shard = 0; shard <= shardNum; shard++) {
+        bounds[shard] = alignToCodePoint(data, size, size * shard / shardNum);
+    }
+
+    vector<TrigramCounts> workerCounts(pool.getThreadCount() + 1);
+    vector<uint64_t> workerTrigramCounts(pool.getThreadCount() + 1, 0);
+    swap(workerCounts.back(), counts);
+
+    pool.parallelFor(shardNum, [&](size_t shard, unsigned worker) {
+        workerTrigramCounts[worker] += countShardTrigrams(text, bounds[shard], bounds[shard + 1], workerCounts[worker]);
+    });
+
+    mergeTrigramCounts(workerCounts, pool);
+    swap(counts, workerCounts[0]);
+
+    if (trigramCount) {
+        for (const uint64_t count : workerTrigramCounts) {
+            *trigramCount += count;
+        }
+    }
+}
+
+/**
+ * @brief Merges trigram counts in parallel, halving the number of maps in
+ *        every round. Must not be called from a pool thread.
+ *
+ * @param counts The counts to merge; the total is left in counts[0] and the
+ *               others are emptied
+ * @param pool Thread pool
+ */
+void mergeTrigramCounts(vector<TrigramCounts>& counts, ThreadPool& pool) {
+    for (size_t step = 1; step < counts.size(); step *= 2) {
+        const size_t pairNum = (counts.size() + step) / (2 * step);
+
+        pool.parallelFor(pairNum, [&](size_t pair, unsigned) {
+            TRACE_SCOPE("merge counts");
+            PerfScope perfScope(PerfStage::Profile);
+            const size_t to = pair * 2 * step;
+            const size_t from = to + step;
+            if (from >= counts.size())
+                return;
+
+            // Insert the smaller map into the larger one
+            if (counts[to].size() < counts[from].size())
+                swap(counts[to], counts[from]);
+            for (const auto& [trigram, count] : counts[from]) {
+                counts[to][trigram] += count;
+            }
+            TrigramCounts().swap(counts[from]);
+        });
+    }
+}
+
+/**
+ * @brief Counts the trigrams of a text into an existing profile, with every
+ *        pool thread when the text is large.
+ *
+ * Counts are kept exact while counting, so very frequent trigrams of huge
+ * texts do not saturate at float precision. Texts shorter than
+ * PARALLEL_PROFILE_MIN_CHARACTERS, and calls from a pool thread, fall back to
+ * the serial build.
+ *
+ * @param text Text lines
+ * @param trigrams Destination trigram profile
+ * @param pool Thread pool
+ * @param trigramCount If not null, receives the number of trigrams counted
+ */
+void buildTrigramProfile(const Text& text, TrigramProfile& trigrams, ThreadPool& pool, uint64_t* trigramCount) {
+    if (!isParallelProfile(text, pool)) {
+        buildTrigramProfile(text, trigrams, trigramCount);
+        return;
+    }
+
+    TRACE_SCOPE("extract trigrams (parallel)");
+
+    TrigramCounts counts;
+    countTrigrams(text, counts, pool, trigramCount);
+
+    trigrams.reserve(trigrams.size() + counts.size());
+    for (const auto& [trigram, count] : counts) {
+        trigrams[trigram] += (float)count;
+    }
+}
+
+/**
+ * @brief Builds a text profile in bounded memory.
+ *
+ * Only trigrams of the model get an exact count, since the others never
+ * add to a dot product. The others are counted in a fixed-size count-min
+ * sketch that only estimates their share of the norm: every row's sum of
+ * squared counters overestimates it (collisions only add), so the smallest
+ * one is used. The profile holds at most modelTrigrams.size() entries and
+ * the sketch SKETCH_ROW_NUM << SKETCH_WIDTH_BITS counters, whatever the text.
+ *
+ * @param text Text lines
+ * @param modelTrigrams The trigrams of every language profile
+ * @param trigrams Destination profile (counts of model trigrams only)
+ * @param trigramCount If not null, receives the number of trigrams counted
+ * @return float The norm of the whole profile, for normalizeTrigramProfile
+ */
+float buildBoundedTrigramProfile(const Text& text, const TrigramSet& modelTrigrams,
+                                 TrigramProfile& trigrams, uint64_t* trigramCount) {
+    TRACE_SCOPE("extract trigrams (bounded)");
+    pmr::vector<uint32_t> sketch((size_t)SKETCH_ROW_NUM << SKETCH_WIDTH_BITS, 0,
+                                 trigrams.get_allocator().resource());
+    uint64_t count = 0;
+
+    for (const u16string_view line : text) {
+        forEachTrigramInLine(line, [&](uint64_t trigram) {
+            count++;
+            if (modelTrigrams.count(trigram)) {
+                ++trigrams[trigram];
+                return;
+            }
+            for (int row = 0; row < SKETCH_ROW_NUM; row++) {
+                sketch[getSketchIndex(trigram, row)]++;
+            }
+        });
+    }
+
+    double normSquared = 0.0;
+    for (const auto& [key, value] : trigrams) {
+        normSquared += (double)value * value;
+    }
+
+    double sketchNormSquared = -1.0;
+    for (int row = 0; row < SKETCH_ROW_NUM; row++) {
+        const uint32_t* counters = sketch.data() + ((size_t)row << SKETCH_WIDTH_BITS);
+        const double rowSquared = getKernels().sumOfSquares(counters, (size_t)1 << SKETCH_WIDTH_BITS);
+        if (sketchNormSquared < 0.0 || rowSquared < sketchNormSquared)
+            sketchNormSquared = rowSquared;
+    }
+
+    if (trigramCount)
+        *trigramCount = count;
+    return (float)sqrt(normSquared + sketchNormSquared);
+}
+
+/**
+ * @brief Appends every trigram of a text to a list, in text order.
+ * @param text Text lines
+ * @param trigrams Destination list
+ */
+void extractTrigrams(const Text& text, TrigramList& trigrams) {
+    // A line of n characters has at most n - 2 trigrams
+    trigrams.reserve(trigrams.size() + text.characters.size());
+
+    for (const u16string_view line : text) {
+        forEachTrigramInLine(line, [&](uint64_t trigram) { trigrams.push_back(trigram); });
+    }
+}
+
+/**
+ * @brief Sorts packed trigrams with an LSD radix sort.
+ *
+ * A first pass builds the histogram of every digit; digits that are the same
+ * for every trigram are skipped, so text in a script below U+0800 takes three
+ * scattering passes instead of six. The scratch buffer comes from the list's
+ * own memory resource.
+ *
+ * @param trigrams The trigrams to sort
+ */
+void sortTrigrams(TrigramList& trigrams) {
+    const size_t count = trigrams.size();
+    if (count < 2)
+        return;
+
+    int shifts[RADIX_DIGIT_NUM];
+    uint64_t masks[RADIX_DIGIT_NUM];
+    for (int digit = 0; digit < RADIX_DIGIT_NUM; digit++) {
+        shifts[digit] = getRadixShift(digit);
+        masks[digit] = getRadixMask(digit);
+    }
+
+    vector<size_t> histograms(RADIX_DIGIT_NUM * RADIX_BUCKET_NUM, 0);
+    for (const uint64_t trigram : trigrams) {
+        for (int digit = 0; digit < RADIX_DIGIT_NUM; digit++) {
+            histograms[digit * RADIX_BUCKET_NUM + ((trigram >> shifts[digit]) & masks[digit])]++;
+        }
+    }
+
+    TrigramList scratch(count, trigrams.get_allocator());
+    uint64_t* source = trigrams.data();
+    uint64_t* destination = scratch.data();
+
+    for (int digit = 0; digit < RADIX_DIGIT_NUM; digit++) {
+        const int shift = shifts[digit];
+        const uint64_t mask = masks[digit];
+        size_t* offsets = histograms.data() + digit * RADIX_BUCKET_NUM;
+        if (offsets[(source[0] >> shift) & mask] == count)
+            continue;
+
+        size_t offset = 0;
+        for (size_t bucket = 0; bucket < RADIX_BUCKET_NUM; bucket++) {
+            const size_t bucketSize = offsets[bucket];
+            offsets[bucket] = offset;
+            offset += bucketSize;
+        }
+
+        for (size_t i = 0; i < count; i++) {
+            const uint64_t trigram = source[i];
+            destination[offsets[(trigram >> shift) & mask]++] = trigram;
+        }
+        swap(source, destination);
+    }
+
+    if (source != trigrams.data())
+        trigrams.swap(scratch);
+}
+
+/**
+ * @brief Builds the profile of a text by sorting its trigrams.
+ *
+ * The trigrams are written to a list, radix sorted and run-length encoded
+ * into (trigram, count) pairs: sequential passes with no hashing, which
+ * stay fast when the profile of a large text no longer fits in the caches.
+ * The list lives in the profile's memory resource (so, in a Workspace, it
+ * is freed with the profile).
+ *
+ * @param text Text lines
+ * @param trigrams Destination profile (counts, sorted by trigram)
+ * @param trigramCount If not null, receives the number of trigrams counted
+ */
+void buildSortedTrigramProfile(const Text& text, SortedTrigramProfile& trigrams, uint64_t* trigramCount) {
+    TRACE_SCOPE("extract trigrams (sorted)");
+    TrigramList list(trigrams.get_allocator().resource());
+    extractTrigrams(text, list);
+    {
+        TRACE_SCOPE("sort trigrams");
+        sortTrigrams(list);
+    }
+
+    trigrams.clear();
+    appendTrigramRuns(list, trigrams);
+
+    if (trigramCount)
+        *trigramCount = list.size();
+}
+
+/**
+ * @brief Builds the profile of a small-alphabet text by direct indexing.
+ *
+ * The 63 most frequent characters at the start of the text become an
+ * alphabet of 6-bit symbols, in code point order. Trigrams made only of
+ * alphabet characters are counted with a single increment into an array of
+ * 64^3 counters (1 MiB, which stays in the L2 cache), with no hashing or
+ * sorting; since the symbols keep code point order, scanning the array
+ * yields them already sorted. The few trigrams with another character are
+ * radix sorted apart and merged in. The arrays live in the profile's
+ * memory resource.
+ *
+ * @param text Text lines
+ * @param trigrams Destination profile (counts, sorted by trigram)
+ * @param trigramCount If not null, receives the number of trigrams counted
+ * @return Whether the alphabet covered the text (if not, trigrams is left
+ *         untouched and the text should be profiled some other way)
+ */
+bool buildDenseTrigramProfile(const Text& text, SortedTrigramProfile& trigrams, uint64_t* trigramCount) {
+    TRACE_SCOPE("extract trigrams (dense)");
+    pmr::memory_resource* resource = trigrams.get_allocator().resource();
+
+    // Pick the alphabet: the most frequent characters of the sample
+    const char16_t* characters = text.characters.data();
+    const size_t sampleSize = min(text.characters.size(), DENSE_SAMPLE_SIZE);
+    pmr::vector<uint32_t> frequencies(DENSE_TABLE_SIZE, 0, resource);
+    for (size_t i = 0; i < sampleSize; i++) {
+        if (characters[i] < DENSE_TABLE_SIZE)
+            frequencies[characters[i]]++;
+    }
+
+    pmr::vector<char32_t> alphabet(resource);
+    for (size_t c = 0; c < DENSE_TABLE_SIZE; c++) {
+        if (frequencies[c])
+            alphabet.push_back((char32_t)c);
+    }
+    if (alphabet.size() > DENSE_OTHER_SYMBOL) {
+        nth_element(alphabet.begin(), alphabet.begin() + DENSE_OTHER_SYMBOL, alphabet.end(),
+                    [&](char32_t a, char32_t b) { return frequencies[a] > frequencies[b]; });
+        alphabet.resize(DENSE_OTHER_SYMBOL);
+        sort(alphabet.begin(), alphabet.end());
+    }
+
+    size_t coveredNum = 0;
+    for (const char32_t c : alphabet) {
+        coveredNum += frequencies[c];
+    }
+    if (!sampleSize || coveredNum < DENSE_MIN_COVERAGE * sampleSize)
+        return false;
+
+    uint8_t symbols[DENSE_TABLE_SIZE];
+    memset(symbols, DENSE_OTHER_SYMBOL, sizeof(symbols));
+    for (size_t symbol = 0; symbol < alphabet.size(); symbol++) {
+        symbols[alphabet[symbol]] = (uint8_t)symbol;
+    }
+
+    // Count: the index holds the symbols of the last three characters
+    pmr::vector<uint32_t> counters(DENSE_COUNTER_NUM, 0, resource);
+    TrigramList otherTrigrams(resource);
+    uint64_t count = 0;
+
+    for (const u16string_view line : text) {
+        const size_t len = line.length();
+        if (len < 3)
+            continue;
+
+        const char16_t* data = line.data();
+        size_t index = 0;
+        size_t sinceOther = 0;
+        size_t characterNum = 0;
+        char32_t first = 0;
+        char32_t second = 0;
+
+        size_t i = 0;
+        while (i < len) {
+            const char32_t c = decodeCodePoint(data, len, i);
+            const uint8_t symbol = (c < DENSE_TABLE_SIZE) ? symbols[c] : DENSE_OTHER_SYMBOL;
+            index = ((index << DENSE_SYMBOL_BITS) | symbol) & (DENSE_COUNTER_NUM - 1);
+            sinceOther = (symbol == DENSE_OTHER_SYMBOL) ? 0 : sinceOther + 1;
+
+            if (++characterNum >= 3) {
+                if (sinceOther >= 3) {
+                    counters[index]++;
+                }
+                else {
+                    const uint64_t trigram = ((uint64_t)first << (2 * TRIGRAM_CODEPOINT_BITS)) |
+                                             ((uint64_t)second << TRIGRAM_CODEPOINT_BITS) | c;
+                    if (trigram != 0)
+                        otherTrigrams.push_back(trigram);
+                }
+            }
+            first = second;
+            second = c;
+        }
+    }
+
+    SortedTrigramProfile otherProfile(resource);
+    sortTrigrams(otherTrigrams);
+    appendTrigramRuns(otherTrigrams, otherProfile);
+    count += otherTrigrams.size();
+
+    // Merge both sorted sequences (they never share a trigram)
+    trigrams.clear();
+    auto other = otherProfile.begin();
+    for (size_t index = 0; index < DENSE_COUNTER_NUM; index++) {
+        const uint32_t counter = counters[index];
+        if (!counter)
+            continue;
+
+        const uint64_t trigram =
+            ((uint64_t)alphabet[index >> (2 * DENSE_SYMBOL_BITS)] << (2 * TRIGRAM_CODEPOINT_BITS)) |
+            ((uint64_t)alphabet[(index >> DENSE_SYMBOL_BITS) & DENSE_OTHER_SYMBOL] << TRIGRAM_CODEPOINT_BITS) |
+            alphabet[index & DENSE_OTHER_SYMBOL];
+        if (!trigram)
+            continue;
+
+        for (; other != otherProfile.end() && other->trigram < trigram; ++other) {
+            trigrams.push_back(*other);
+        }
+        trigrams.push_back({ trigram, (float)counter });
+        count += counter;
+    }
+    trigrams.insert(trigrams.end(), other, otherProfile.end());
+
+    if (trigramCount)
+        *trigramCount = count;
+    return true;
+}
+
+/**
+ * @brief Collects the trigrams of all language profiles.
+ * @param languages A list of Language objects
+ * @return TrigramSet Every trigram with a weight in some language
+ */
+TrigramSet getModelTrigrams(const LanguageProfiles& languages) {
+    const TrigramVocabulary& vocabulary = getTrigramVocabulary();
+    TrigramSet modelTrigrams;
+
+    for (const LanguageProfile& language : languages) {
+        for (const TrigramIdWeight& entry : language.idProfile) {
+            modelTrigrams.insert(vocabulary.getTrigram(entry.id));
+        }
+    }
+    return modelTrigrams;
 }
 
 /**
@@ -103,7 +1052,16 @@ void normalizeTrigramProfile(TrigramProfile& trigramProfile) {
     if (trigramProfile.empty())
         return;
 
-    const float norm = calculateNorm(trigramProfile);
+    normalizeTrigramProfile(trigramProfile, calculateNorm(trigramProfile));
+}
+
+/**
+ * @brief Normalizes a trigram profile with a norm computed elsewhere (by
+ *        buildBoundedTrigramProfile, when the profile is not complete).
+ * @param trigramProfile The trigram profile.
+ * @param norm The norm of the complete profile.
+ */
+void normalizeTrigramProfile(TrigramProfile& trigramProfile, float norm) {
     if (norm > 0.0f) {
         const float invNorm = 1.0f / norm;
         for (auto& [key, value] : trigramProfile) {
@@ -112,6 +1070,31 @@ void normalizeTrigramProfile(TrigramProfile& trigramProfile) {
     }
 }
 
+/**
+ * @brief Normalizes a sorted trigram profile.
+ * @param trigramProfile The trigram profile.
+ */
+void normalizeTrigramProfile(SortedTrigramProfile& trigramProfile) {
+    if (trigramProfile.empty())
+        return;
+
+    normalizeTrigramProfile(trigramProfile, calculateNorm(trigramProfile));
+}
+
+/**
+ * @brief Normalizes a sorted trigram profile with a norm computed elsewhere.
+ * @param trigramProfile The trigram profile.
+ * @param norm The norm of the complete profile.
+ */
+void normalizeTrigramProfile(SortedTrigramProfile& trigramProfile, float norm) {
+    if (norm > 0.0f) {
+        const float invNorm = 1.0f / norm;
+        for (TrigramWeight& entry : trigramProfile) {
+            entry.weight *= invNorm;
+        }
+    }
+}
+
 /**
  * @brief Calculates the cosine similarity between two trigram profiles
  * @param textProfile The text trigram profile
@@ -138,72 +1121,457 @@ float getCosineSimilarity(const TrigramProfile& textProfile, const TrigramProfil
     return dotProduct;
 }
 
+/**
+ * @brief Calculates the cosine similarity between two trigram id profiles
+ *        with a merge join.
+ *
+ * Each id of the smaller profile is searched for in the rest of the larger
+ * one with a galloping search, so a short language profile against a large
+ * text profile costs far less than a full linear merge.
+ *
+ * @param textProfile The text trigram profile
+ * @param languageProfile The language trigram profile
+ * @return float The cosine similarity score
+ */
+float getCosineSimilarity(const TrigramIdProfile& textProfile, const TrigramIdProfile& languageProfile) {
+    if (textProfile.empty() || languageProfile.empty())
+        return 0.0f;
+
+    const auto& smallerProfile = textProfile.size() < languageProfile.size() ? textProfile : languageProfile;
+    const auto& largerProfile = textProfile.size() < languageProfile.size() ? languageProfile : textProfile;
+
+    float dotProduct = 0.0f;
+    const TrigramIdWeight* position = largerProfile.data();
+    const TrigramIdWeight* const end = largerProfile.data() + largerProfile.size();
+
+    for (const TrigramIdWeight& entry : smallerProfile) {
+        // Double the step until it passes the id, then bisect the last step
+        const size_t remaining = end - position;
+        size_t bound = 1;
+        while (bound < remaining && position[bound].id < entry.id)
+            bound *= 2;
+
+        position = lower_bound(position + bound / 2, position + min(bound + 1, remaining), entry.id,
+                               [](const TrigramIdWeight& a, TrigramId id) { return a.id < id; });
+        if (position == end)
+            break;
+        if (position->id == entry.id)
+            dotProduct += entry.weight * (position++)->weight;
+    }
+
+    return dotProduct;
+}
+
+/**
+ * @brief Calculates the cosine similarity between a dense text profile and
+ *        a language profile, with the gatherDot kernel.
+ *
+ * Ids interned after the text profile was built are past its end: the text
+ * has none of those trigrams, so they are left out.
+ *
+ * @param textProfile The text weights by id
+ * @param languageProfile The language trigram profile
+ * @return float The cosine similarity score
+ */
+float getCosineSimilarity(const DenseTrigramIdProfile& textProfile, const TrigramIdProfile& languageProfile) {
+    if (textProfile.empty() || languageProfile.empty())
+        return 0.0f;
+
+    size_t count = languageProfile.size();
+    if (languageProfile.back().id >= textProfile.size()) {
+        count = lower_bound(languageProfile.begin(), languageProfile.end(), (TrigramId)textProfile.size(),
+                            [](const TrigramIdWeight& a, TrigramId id) { return a.id < id; }) -
+                languageProfile.begin();
+    }
+    return getKernels().gatherDot(textProfile.data(), languageProfile.data(), count);
+}
+
 /**
  * @brief Identifies the language of a text.
- * @param text A Text (vector of lines)
+ * @param text A Text (lines of lowercased UTF-16)
  * @param languages A list of Language objects
  * @return string The language code of the most likely language
  */
 string identifyLanguage(const Text& text, const LanguageProfiles& languages) {
-    if (text.empty() || languages.empty()) {
-        return "unknown";
+    return identifyLanguage(text, languages, getThreadWorkspace());
+}
+
+/**
+ * @brief Identifies the language of a text, with scratch memory from a workspace.
+ * @param text A Text (lines of lowercased UTF-16)
+ * @param languages A list of Language objects
+ * @param workspace Arena for the text profile, released when the call returns
+ *                  (unless the caller holds an outer Workspace::Scope)
+ * @return string The language code of the most likely language
+ */
+string identifyLanguage(const Text& text, const LanguageProfiles& languages, Workspace& workspace) {
+    return guessLanguage(text, languages, workspace).languageCode;
+}
+
+/**
+ * @brief Identifies the language of a text and reports how good the match is.
+ * @param text A Text (lines of lowercased UTF-16)
+ * @param languages A list of Language objects
+ * @param workspace Arena for the text profile, released when the call returns
+ *                  (unless the caller holds an outer Workspace::Scope)
+ * @param options Thread pool and bounded-memory profile (see IdentifyOptions)
+ * @return LanguageGuess The most likely language, its similarity and its
+ *         margin over the second most likely one
+ */
+LanguageGuess guessLanguage(const Text& text, const LanguageProfiles& languages, Workspace& workspace,
+                            const IdentifyOptions& options) {
+    return guessLanguageAmong(text, languages, workspace, options);
+}
+
+/**
+ * @brief Identifies the language of a text from its normalized profile (for
+ *        instance, one stored by DiskCache).
+ * @param textProfile Normalized trigram profile of the text
+ * @param languages A list of Language objects
+ * @return LanguageGuess The most likely language, its similarity and its margin
+ */
+LanguageGuess guessLanguage(const TrigramProfile& textProfile, const LanguageProfiles& languages) {
+    if (textProfile.empty() || languages.empty()) {
+        return { "unknown", 0.0f, 0.0f };
     }
+    return scoreProfile(textProfile, languages);
+}
 
-    TrigramProfile textTrigrams = buildTrigramProfile(text);
-    if (textTrigrams.empty()) {
-        return "unknown";
+/**
+ * @brief Identifies the language of a UTF-8 document chunk by chunk,
+ *        reporting the best guesses after every chunk.
+ *
+ * Chunks end at a line break when there is one (trigrams never span lines).
+ * A line longer than a chunk is cut at a code point boundary, and its last
+ * two code points are decoded again with the next chunk, so the trigrams
+ * across the cut are counted too. The final result matches guessLanguage
+ * on the whole document (when it is valid UTF-8). The trigram counts
+ * accumulate across chunks and are rescored after each one.
+ *
+ * @param data Start of the document (for instance, a memory-mapped file)
+ * @param size Size of the document in bytes
+ * @param languages A list of Language objects
+ * @param workspace Arena for the text profile, released when the call returns
+ * @param onProgress Receives the guesses after each chunk; returning false
+ *                   stops the identification
+ * @return LanguageGuess The most likely language of the part that was read
+ */
+LanguageGuess guessLanguageProgressively(const char* data, size_t size, const LanguageProfiles& languages,
+                                         Workspace& workspace, const ProgressCallback& onProgress) {
+    TRACE_SCOPE("identify progressively");
+    const LanguageGuess unknownGuess = { "unknown", 0.0f, 0.0f };
+
+    if (!size || languages.empty()) {
+        return unknownGuess;
     }
 
-    normalizeTrigramProfile(textTrigrams);
+    addMetric(MetricCounter::DocumentsProcessed);
 
-    float maxSimilarity = -1.0f;
-    const string* bestLanguageCode = nullptr;
+    Workspace::Scope scope(workspace);
+    TrigramProfile counts(workspace.getResource());
+    // Scored after every chunk: allocated once and reused, since the arena
+    // only frees at the end
+    TrigramIdProfile countIds(workspace.getResource());
+    DenseTrigramIdProfile countWeights(workspace.getResource());
+    // Chunks are decoded on the heap: the profile keeps growing in the arena
+    Text chunkText;
+    LanguageProgress progress = {};
+    progress.totalBytes = size;
+    uint64_t trigramCount = 0;
 
-    for (const auto& langProfile : languages) {
-        const float similarity = getCosineSimilarity(textTrigrams, langProfile.trigramProfile);
+    size_t chunkSize = PROGRESS_FIRST_CHUNK_SIZE;
+    size_t position = 0;
+    size_t carriedSize = 0; // Bytes before position decoded again with this chunk
+    while (position < size) {
+        const uint64_t chunkStartTime = LEQUEL_PROBE_TIME(chunk_processed);
+        const size_t chunkStart = position;
+        size_t end = size;
+        if (size - position > chunkSize) {
+            end = position + chunkSize;
 
-        if (similarity > maxSimilarity) {
-            maxSimilarity = similarity;
-            bestLanguageCode = &langProfile.languageCode;
+            const void* lineBreak = memrchr(data + position, '\n', end - position);
+            if (lineBreak) {
+                end = (const char*)lineBreak - data + 1;
+            }
+            else if (data[end] == '\n') {
+                end++;
+            }
+            else {
+                // A single huge line: cut it at a code point boundary
+                while (end > position + 1 && ((unsigned char)data[end] & 0xC0) == 0x80)
+                    end--;
+            }
         }
+
+        if (!getTextFromBuffer(data + position - carriedSize, end - position + carriedSize, chunkText)) {
+            break;
+        }
+        {
+            MetricTimer timer(MetricHistogram::ProfileLatency);
+            PerfScope perfScope(PerfStage::Profile);
+            uint64_t chunkTrigramCount = 0;
+            buildTrigramProfile(chunkText, counts, &chunkTrigramCount);
+            trigramCount += chunkTrigramCount;
+        }
+        // Cut inside a line: carry its last two code points to the next chunk
+        carriedSize = 0;
+        if (end < size && data[end - 1] != '\n') {
+            size_t carryStart = end;
+            for (int i = 0; i < 2 && carryStart > position; i++) {
+                do {
+                    carryStart--;
+                } while (carryStart > position && ((unsigned char)data[carryStart] & 0xC0) == 0x80);
+            }
+            carriedSize = end - carryStart;
+        }
+        position = end;
+        chunkSize = min(chunkSize * 2, PROGRESS_MAX_CHUNK_SIZE);
+
+        {
+            MetricTimer timer(MetricHistogram::ScoreLatency);
+            PerfScope perfScope(PerfStage::Score);
+            TRACE_SCOPE("score");
+            progress.guessNum = getTopGuesses(counts, calculateNorm(counts), languages, countIds, countWeights,
+                                              progress.guesses, PROGRESS_GUESS_NUM);
+        }
+        progress.processedBytes = position;
+        LEQUEL_PROBE4(chunk_processed, position - chunkStart, position, size, getProbeDuration(chunkStartTime));
+
+        if (!onProgress(progress)) {
+            break;
+        }
+    }
+
+    addMetric(MetricCounter::TrigramsCounted, trigramCount);
+    recordMetric(MetricHistogram::ProfileSize, counts.size());
+
+    if (!progress.guessNum || progress.guesses[0].similarity <= SIMILARITY_THRESHOLD) {
+        return unknownGuess;
+    }
+    return progress.guesses[0];
+}
+
+/**
+ * @brief Identifies the language of a text among some candidate languages.
+ * @param text A Text (lines of lowercased UTF-16)
+ * @param candidates The candidate languages, for instance from LazyModel
+ * @param workspace Arena for the text profile
+ * @param options Thread pool and bounded-memory profile (see IdentifyOptions)
+ * @return LanguageGuess The most likely language, its similarity and its margin
+ */
+LanguageGuess guessLanguage(const Text& text, const LanguageCandidates& candidates, Workspace& workspace,
+                            const IdentifyOptions& options) {
+    return guessLanguageAmong(text, candidates, workspace, options);
+}
+
+/**
+ * @brief Finds the scripts a text is written in.
+ * @param text A Text (lines of lowercased UTF-16)
+ * @return uint64_t Bit mask of script buckets (see getScriptBucket)
+ */
+uint64_t getScriptMask(const Text& text) {
+    uint64_t mask = 0;
+
+    for (const u16string_view line : text) {
+        size_t i = 0;
+        while (i < line.length()) {
+            const int bucket = getScriptBucket(decodeCodePoint(line.data(), line.length(), i));
+            if (bucket >= 0)
+                mask |= uint64_t(1) << bucket;
+        }
+    }
+    return mask;
+}
+
+/**
+ * @brief Finds the scripts of the characters of a packed trigram.
+ * @return uint64_t Bit mask of script buckets (see getScriptBucket)
+ */
+uint64_t getTrigramScriptMask(uint64_t trigram) {
+    uint64_t mask = 0;
+
+    for (int shift = 0; shift <= 2 * TRIGRAM_CODEPOINT_BITS; shift += TRIGRAM_CODEPOINT_BITS) {
+        const int bucket = getScriptBucket(char32_t((trigram >> shift) & TRIGRAM_CODEPOINT_MASK));
+        if (bucket >= 0)
+            mask |= uint64_t(1) << bucket;
     }
-	const float similarityThreshold = 0.01f; // Minimum similarity to consider a match
-    bool isConfidentMatch = (maxSimilarity > similarityThreshold) &&
-                            bestLanguageCode != nullptr;
+    return mask;
+}
 
-    if (maxSimilarity > similarityThreshold && bestLanguageCode != nullptr) {
-        return *bestLanguageCode;
+/**
+ * @brief Maps a character to a coarse script bucket, for prefiltering.
+ *
+ * Punctuation, digits, symbols and combining marks are shared by every
+ * script, so they map to no bucket. Letters outside the listed scripts all
+ * share SCRIPT_BUCKET_OTHER.
+ *
+ * @param c The character
+ * @return int Bucket in [0, 64), or -1 if the character has no script
+ */
+int getScriptBucket(char32_t c) {
+    // { first, last, bucket }, sorted by first character
+    static const struct { char32_t first, last; int bucket; } scriptRanges[] = {
+        { 0x0000, 0x0040, -1 },     // ASCII controls, punctuation and digits
+        { 0x0041, 0x005A, 0 },      // Latin
+        { 0x005B, 0x0060, -1 },
+        { 0x0061, 0x007A, 0 },
+        { 0x007B, 0x00BF, -1 },     // Latin-1 punctuation and symbols
+        { 0x00C0, 0x024F, 0 },
+        { 0x0250, 0x02FF, SCRIPT_BUCKET_OTHER },
+        { 0x0300, 0x036F, -1 },     // Combining diacritical marks
+        { 0x0370, 0x03FF, 1 },      // Greek
+        { 0x0400, 0x052F, 2 },      // Cyrillic
+        { 0x0530, 0x058F, 3 },      // Armenian
+        { 0x0590, 0x05FF, 4 },      // Hebrew
+        { 0x0600, 0x06FF, 5 },      // Arabic
+        { 0x0700, 0x074F, 6 },      // Syriac
+        { 0x0750, 0x077F, 5 },
+        { 0x0780, 0x07BF, 7 },      // Thaana
+        { 0x0900, 0x097F, 8 },      // Devanagari
+        { 0x0980, 0x09FF, 9 },      // Bengali
+        { 0x0A00, 0x0A7F, 10 },     // Gurmukhi
+        { 0x0A80, 0x0AFF, 11 },     // Gujarati
+        { 0x0B00, 0x0B7F, 12 },     // Oriya
+        { 0x0B80, 0x0BFF, 13 },     // Tamil
+        { 0x0C00, 0x0C7F, 14 },     // Telugu
+        { 0x0C80, 0x0CFF, 15 },     // Kannada
+        { 0x0D00, 0x0D7F, 16 },     // Malayalam
+        { 0x0D80, 0x0DFF, 17 },     // Sinhala
+        { 0x0E00, 0x0E7F, 18 },     // Thai
+        { 0x0E80, 0x0EFF, 19 },     // Lao
+        { 0x0F00, 0x0FFF, 20 },     // Tibetan
+        { 0x1000, 0x109F, 21 },     // Myanmar
+        { 0x10A0, 0x10FF, 22 },     // Georgian
+        { 0x1100, 0x11FF, 23 },     // Hangul
+        { 0x1200, 0x139F, 24 },     // Ethiopic
+        { 0x13A0, 0x13FF, 25 },     // Cherokee
+        { 0x1400, 0x167F, 26 },     // Canadian Aboriginal syllabics
+        { 0x1680, 0x16FF, 27 },     // Ogham and Runic
+        { 0x1780, 0x17FF, 28 },     // Khmer
+        { 0x1800, 0x18AF, 29 },     // Mongolian
+        { 0x1AB0, 0x1AFF, -1 },     // Combining diacritical marks extended
+        { 0x1DC0, 0x1DFF, -1 },     // Combining diacritical marks supplement
+        { 0x1E00, 0x1EFF, 0 },      // Latin extended additional
+        { 0x1F00, 0x1FFF, 1 },      // Greek extended
+        { 0x2000, 0x2BFF, -1 },     // Punctuation, symbols, arrows, shapes
+        { 0x2C80, 0x2CFF, 32 },     // Coptic
+        { 0x2D30, 0x2D7F, 33 },     // Tifinagh
+        { 0x2E00, 0x2E7F, -1 },     // Supplemental punctuation
+        { 0x3000, 0x303F, -1 },     // CJK punctuation
+        { 0x3040, 0x30FF, 30 },     // Hiragana and Katakana
+        { 0x3130, 0x318F, 23 },     // Hangul compatibility jamo
+        { 0x3400, 0x4DBF, 31 },     // CJK ideographs extension A
+        { 0x4E00, 0x9FFF, 31 },     // CJK ideographs
+        { 0xA000, 0xA4CF, 34 },     // Yi
+        { 0xA500, 0xA63F, 35 },     // Vai
+        { 0xAB70, 0xABBF, 25 },     // Cherokee supplement
+        { 0xAC00, 0xD7AF, 23 },     // Hangul syllables
+        { 0xD800, 0xDFFF, -1 },     // Unpaired surrogates
+        { 0xF900, 0xFAFF, 31 },     // CJK compatibility ideographs
+        { 0xFB1D, 0xFB4F, 4 },      // Hebrew presentation forms
+        { 0xFB50, 0xFDFF, 5 },      // Arabic presentation forms A
+        { 0xFE00, 0xFE6F, -1 },     // Variation selectors, small forms
+        { 0xFE70, 0xFEFF, 5 },      // Arabic presentation forms B
+        { 0xFF00, 0xFFEF, -1 },     // Halfwidth and fullwidth forms
+        { 0xFFF0, 0xFFFF, -1 },     // Specials
+        { 0x1F000, 0x1FFFF, -1 },   // Emoji and pictographs
+        { 0x20000, 0x3FFFF, 31 },   // CJK ideographs extensions B and later
+    };
+
+    // Last range starting at or before c
+    size_t low = 0, high = sizeof(scriptRanges) / sizeof(scriptRanges[0]);
+    while (high - low > 1) {
+        const size_t middle = (low + high) / 2;
+        if (scriptRanges[middle].first <= c)
+            low = middle;
+        else
+            high = middle;
     }
-    return "unknown";
+
+    return (c <= scriptRanges[low].last) ? scriptRanges[low].bucket : SCRIPT_BUCKET_OTHER;
 }
 
 // --- Helper functions ---
 
+uint64_t codepointTrigramToInt(const char32_t* data) {
+    // Packs three 21-bit code points into one 64-bit integer
+    return  (uint64_t(data[0]) << (2 * TRIGRAM_CODEPOINT_BITS)) |
+            (uint64_t(data[1]) << TRIGRAM_CODEPOINT_BITS) |
+             uint64_t(data[2]);
+}
+
 uint64_t wcharTrigramToInt(const wchar_t* data) {
-    // Packs three UTF-16 code units into one 64-bit integer
+    // Packs three UTF-16 code units into one 64-bit integer (legacy packing)
     return  (uint64_t(data[0]) << 32) |
             (uint64_t(data[1]) << 16) |
              uint64_t(data[2]);
 }
 
+uint64_t migrateUtf16Trigram(uint64_t trigram) {
+    const char32_t codepoints[3] = {
+        char32_t((trigram >> 32) & 0xFFFF),
+        char32_t((trigram >> 16) & 0xFFFF),
+        char32_t(trigram & 0xFFFF),
+    };
+
+    // A surrogate means the legacy trigram was half of a supplementary
+    // character: it never occurs in code point packed text
+    for (char32_t c : codepoints) {
+        if (c >= 0xD800 && c <= 0xDFFF)
+            return 0;
+    }
+    return codepointTrigramToInt(codepoints);
+}
+
+std::string intToStringTrigram(uint64_t trigram) {
+    std::string result;
+
+    for (int shift = 2 * TRIGRAM_CODEPOINT_BITS; shift >= 0; shift -= TRIGRAM_CODEPOINT_BITS) {
+        const char32_t c = char32_t((trigram >> shift) & TRIGRAM_CODEPOINT_MASK);
+
+        // UTF-8 encoding
+        if (c < 0x80) {
+            result += char(c);
+        }
+        else if (c < 0x800) {
+            result += char(0xC0 | (c >> 6));
+            result += char(0x80 | (c & 0x3F));
+        }
+        else if (c < 0x10000) {
+            result += char(0xE0 | (c >> 12));
+            result += char(0x80 | ((c >> 6) & 0x3F));
+            result += char(0x80 | (c & 0x3F));
+        }
+        else {
+            result += char(0xF0 | (c >> 18));
+            result += char(0x80 | ((c >> 12) & 0x3F));
+            result += char(0x80 | ((c >> 6) & 0x3F));
+            result += char(0x80 | (c & 0x3F));
+        }
+    }
+    return result;
+}
 
 uint64_t stringTrigramToInt(const std::string& trigram) {
     if (trigram.empty()) return 0;
 
     try {
-        thread_local std::wstring_convert<std::codecvt_utf8_utf16<wchar_t>> conv;
-        wstring wtrigram = conv.from_bytes(trigram);
-        if (wtrigram.length() >= 3) {
-            return wcharTrigramToInt(wtrigram.data());
+        thread_local std::wstring_convert<std::codecvt_utf8<char32_t>, char32_t> conv;
+        u32string codepoints = conv.from_bytes(trigram);
+        if (codepoints.length() >= 3) {
+            return codepointTrigramToInt(codepoints.data());
         }
     }
     catch (const std::exception&) {
         // Fallback: interpret bytes as characters if UTF-8 decoding fails
         if (trigram.length() >= 3) {
-            return (uint64_t(static_cast<unsigned char>(trigram[0])) << 32) |
-                   (uint64_t(static_cast<unsigned char>(trigram[1])) << 16) |
-                    uint64_t(static_cast<unsigned char>(trigram[2]));
+            const char32_t bytes[3] = {
+                char32_t(static_cast<unsigned char>(trigram[0])),
+                char32_t(static_cast<unsigned char>(trigram[1])),
+                char32_t(static_cast<unsigned char>(trigram[2])),
+            };
+            return codepointTrigramToInt(bytes);
         }
     }
     return 0;
-}
\ No newline at end of file
+}
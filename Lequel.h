@@ -11,41 +11,183 @@
 #ifndef LEQUEL_H
 #define LEQUEL_H
 
+#include <cstdint>
+#include <functional>
 #include <vector>
 #include <unordered_map>
+#include <unordered_set>
+#include <memory_resource>
 #include <string>
 
 #include "Text.h"
+#include "Workspace.h"
 
- // TrigramProfile: maps packed Unicode trigram (uint64_t) to its normalized frequency
-typedef std::unordered_map<uint64_t, float> TrigramProfile;
+class ThreadPool;
+class ResultCache;
 
-// TrigramList: holds a sequence of trigrams, stored as 64-bit integers
-typedef std::vector<uint64_t> TrigramList;
+// Trigrams are packed as three 21-bit Unicode code points (bits 42-62, 21-41
+// and 0-20), so supplementary-plane characters are never split in halves.
+// The previous packing used three 16-bit UTF-16 code units (bits 32-47,
+// 16-31 and 0-15); migrateUtf16Trigram() converts those keys.
+enum class TrigramPacking
+{
+    UTF16 = 1,
+    CODEPOINT21 = 2,
+};
+
+const TrigramPacking TRIGRAM_PACKING = TrigramPacking::CODEPOINT21;
+const int TRIGRAM_CODEPOINT_BITS = 21;
+const uint64_t TRIGRAM_CODEPOINT_MASK = (uint64_t(1) << TRIGRAM_CODEPOINT_BITS) - 1;
+const uint64_t TRIGRAM_MASK = (uint64_t(1) << (3 * TRIGRAM_CODEPOINT_BITS)) - 1;
+
+ // TrigramProfile: maps packed Unicode trigram (uint64_t) to its normalized frequency.
+ // Text profiles live in a Workspace arena; language profiles use the default heap.
+typedef std::pmr::unordered_map<uint64_t, float> TrigramProfile;
+
+// TrigramCounts: maps packed Unicode trigram to its exact number of
+// occurrences (used for training, where counts exceed float precision)
+typedef std::unordered_map<uint64_t, uint64_t> TrigramCounts;
+
+// TrigramSet: the trigrams of a whole model (see getModelTrigrams)
+typedef std::unordered_set<uint64_t> TrigramSet;
+
+// TrigramList: holds a sequence of trigrams, stored as 64-bit integers (in
+// text order, or sorted by sortTrigrams)
+typedef std::pmr::vector<uint64_t> TrigramList;
+
+// A trigram and its weight (count or normalized frequency)
+struct TrigramWeight
+{
+    uint64_t trigram;
+    float weight;
+};
+
+// SortedTrigramProfile: the same data as a TrigramProfile, as an array sorted
+// by trigram
+typedef std::pmr::vector<TrigramWeight> SortedTrigramProfile;
+
+// TrigramId: dense id of a trigram in the TrigramVocabulary
+typedef uint32_t TrigramId;
 
-// Stores a language code (ISO string) and its corresponding trigram profile
+struct TrigramIdWeight
+{
+    TrigramId id;
+    float weight;
+};
+
+// TrigramIdProfile: (id, weight) pairs sorted by id, so two profiles are
+// compared with a merge join of small integers
+typedef std::pmr::vector<TrigramIdWeight> TrigramIdProfile;
+
+// DenseTrigramIdProfile: the weight of every vocabulary id (0 for the ones a
+// text lacks), so a language is scored with one gather per entry
+typedef std::pmr::vector<float> DenseTrigramIdProfile;
+
+// Stores a language code (ISO string) and its normalized trigram profile, by
+// id of the shared TrigramVocabulary
 struct LanguageProfile
 {
     std::string languageCode;
-    TrigramProfile trigramProfile;
+    TrigramIdProfile idProfile;
 };
 
 typedef std::vector<LanguageProfile> LanguageProfiles;
 
+// LanguageCandidates: a subset of the loaded languages
+typedef std::vector<const LanguageProfile*> LanguageCandidates;
+
+// Script buckets: bit positions of the masks returned by getScriptMask
+const int SCRIPT_BUCKET_OTHER = 63;
+
+// Result of an identification: the most likely language, its cosine
+// similarity and its margin over the second most likely language
+struct LanguageGuess
+{
+    std::string languageCode;
+    float similarity;
+    float margin;
+};
+
+// Number of guesses reported by guessLanguageProgressively
+const size_t PROGRESS_GUESS_NUM = 3;
+
+// Intermediate result of a progressive identification: the best guesses so
+// far (most likely first) and how much of the document they cover
+struct LanguageProgress
+{
+    LanguageGuess guesses[PROGRESS_GUESS_NUM];
+    size_t guessNum;
+    size_t processedBytes;
+    size_t totalBytes;
+};
+
+// Receives every intermediate result; returning false cancels the rest
+typedef std::function<bool(const LanguageProgress&)> ProgressCallback;
+
+// Optional settings of an identification
+struct IdentifyOptions
+{
+    // Profiles large texts with every thread of this pool
+    ThreadPool* pool = nullptr;
+
+    // Builds the text profile in bounded memory: exact counts only for these
+    // trigrams (see buildBoundedTrigramProfile). Takes precedence over pool.
+    const TrigramSet* modelTrigrams = nullptr;
+
+    // Returns the cached result of a text seen before, and caches new ones
+    ResultCache* cache = nullptr;
+};
+
 // --- Helper functions ---
-// Packs three wide characters into a single 64-bit integer
+// Packs three Unicode code points into a single 64-bit integer
+uint64_t codepointTrigramToInt(const char32_t* data);
+
+// Packs three UTF-16 code units into a single 64-bit integer (legacy packing)
 uint64_t wcharTrigramToInt(const wchar_t* data);
 
-// Converts a packed trigram back into a wstring (3 UTF-16 characters)
-std::wstring intToWcharTrigram(uint64_t trigram);
+// Converts a legacy UTF-16 packed trigram to code point packing (0 if it
+// contains a surrogate)
+uint64_t migrateUtf16Trigram(uint64_t trigram);
+
+// Converts a packed trigram back into a UTF-8 string
+std::string intToStringTrigram(uint64_t trigram);
 
 // Converts a UTF-8 trigram string to a packed uint64_t representation
 uint64_t stringTrigramToInt(const std::string& trigram);
 
 // Functions
 TrigramProfile buildTrigramProfile(const Text& text);
+void buildTrigramProfile(const Text& text, TrigramProfile& trigrams, uint64_t* trigramCount = nullptr);
+void buildTrigramProfile(const Text& text, TrigramProfile& trigrams, ThreadPool& pool,
+                         uint64_t* trigramCount = nullptr);
+void countTrigrams(const Text& text, TrigramCounts& counts);
+void countTrigrams(const Text& text, TrigramCounts& counts, ThreadPool& pool, uint64_t* trigramCount = nullptr);
+void mergeTrigramCounts(std::vector<TrigramCounts>& counts, ThreadPool& pool);
+float buildBoundedTrigramProfile(const Text& text, const TrigramSet& modelTrigrams,
+                                 TrigramProfile& trigrams, uint64_t* trigramCount = nullptr);
+void extractTrigrams(const Text& text, TrigramList& trigrams);
+void sortTrigrams(TrigramList& trigrams);
+void buildSortedTrigramProfile(const Text& text, SortedTrigramProfile& trigrams, uint64_t* trigramCount = nullptr);
+bool buildDenseTrigramProfile(const Text& text, SortedTrigramProfile& trigrams, uint64_t* trigramCount = nullptr);
+TrigramSet getModelTrigrams(const LanguageProfiles& languages);
 void normalizeTrigramProfile(TrigramProfile& trigramProfile);
+void normalizeTrigramProfile(TrigramProfile& trigramProfile, float norm);
+void normalizeTrigramProfile(SortedTrigramProfile& trigramProfile);
+void normalizeTrigramProfile(SortedTrigramProfile& trigramProfile, float norm);
 float getCosineSimilarity(const TrigramProfile& textProfile, const TrigramProfile& language);
+float getCosineSimilarity(const TrigramIdProfile& textProfile, const TrigramIdProfile& language);
+float getCosineSimilarity(const DenseTrigramIdProfile& textProfile, const TrigramIdProfile& language);
 std::string identifyLanguage(const Text& text, const LanguageProfiles& languages);
+std::string identifyLanguage(const Text& text, const LanguageProfiles& languages, Workspace& workspace);
+LanguageGuess guessLanguage(const Text& text, const LanguageProfiles& languages, Workspace& workspace,
+                            const IdentifyOptions& options = IdentifyOptions());
+LanguageGuess guessLanguage(const Text& text, const LanguageCandidates& candidates, Workspace& workspace,
+                            const IdentifyOptions& options = IdentifyOptions());
+LanguageGuess guessLanguage(const TrigramProfile& textProfile, const LanguageProfiles& languages);
+LanguageGuess guessLanguageProgressively(const char* data, size_t size, const LanguageProfiles& languages,
+                                         Workspace& workspace, const ProgressCallback& onProgress);
+int getScriptBucket(char32_t c);
+uint64_t getScriptMask(const Text& text);
+uint64_t getTrigramScriptMask(uint64_t trigram);
 
 #endif
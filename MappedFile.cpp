@@ -0,0 +1,102 @@
+/**
+ * @brief Lequel? read-only memory-mapped files
+ * @author Dylan Frigerio, Micaela Dinsen
+ *
+ * @copyright Copyright (c) 2022-2023
+ */
+
+#include <cstdio>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "MappedFile.h"
+
+using namespace std;
+
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+/**
+ * @brief Maps a whole regular file into memory.
+ *
+ * @param path Path of file to map
+ * @return Function succeeded
+ */
+bool MappedFile::open(const string &path)
+{
+    close();
+
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        perror(("Error while opening file " + path).c_str());
+        return false;
+    }
+
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) < 0 || !S_ISREG(fileStat.st_mode))
+    {
+        perror(("Error while mapping file " + path).c_str());
+        ::close(fd);
+        return false;
+    }
+
+    bool success = map(fd, (size_t)fileStat.st_size);
+    if (!success)
+        perror(("Error while mapping file " + path).c_str());
+
+    // The mapping stays valid after the descriptor is closed
+    ::close(fd);
+
+    return success;
+}
+
+/**
+ * @brief Maps the first bytes of an open file (the descriptor is not closed).
+ *
+ * @param fd Descriptor of a regular file
+ * @param size Number of bytes to map
+ * @return Function succeeded
+ */
+bool MappedFile::map(int fd, size_t size)
+{
+    close();
+
+    if (size)
+    {
+        void *address = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (address == MAP_FAILED)
+            return false;
+
+        data = (const char *)address;
+        mapped = true;
+    }
+    this->size = size;
+
+    return true;
+}
+
+/**
+ * @brief Tells the kernel the mapping will be read once, front to back, so
+ *        it reads ahead aggressively and drops pages behind.
+ */
+void MappedFile::adviseSequential()
+{
+    if (mapped)
+        madvise((void *)data, size, MADV_SEQUENTIAL);
+}
+
+void MappedFile::close()
+{
+    if (mapped)
+        munmap((void *)data, size);
+
+    data = nullptr;
+    size = 0;
+    mapped = false;
+}
@@ -0,0 +1,38 @@
+/**
+ * @brief Lequel? read-only memory-mapped files
+ * @author Dylan Frigerio, Micaela Dinsen
+ *
+ * @copyright Copyright (c) 2022-2023
+ */
+
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include <cstddef>
+#include <string>
+
+class MappedFile
+{
+public:
+    MappedFile() = default;
+    ~MappedFile();
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    bool open(const std::string &path);
+    bool map(int fd, size_t size);
+    void close();
+
+    void adviseSequential();
+
+    const char *getData() const { return data; }
+    size_t getSize() const { return size; }
+
+private:
+    const char *data = nullptr;
+    size_t size = 0;
+    bool mapped = false;
+};
+
+#endif
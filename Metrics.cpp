@@ -0,0 +1,211 @@
+/**
+ * @brief Lequel? hot-path metrics (counters and histograms)
+ * @author Dylan Frigerio, Micaela Dinsen
+ *
+ * @copyright Copyright (c) 2022-2023
+ */
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <algorithm>
+
+#include "Metrics.h"
+
+using namespace std;
+
+namespace {
+    const size_t COUNTER_NUM = (size_t)MetricCounter::Count;
+    const size_t HISTOGRAM_NUM = (size_t)MetricHistogram::Count;
+
+    // Bucket i holds values in [2^(i-1), 2^i); bucket 0 holds zero
+    const size_t HISTOGRAM_BUCKETS = 65;
+
+    const char* const COUNTER_NAMES[COUNTER_NUM] = {
+        "documents_processed",
+        "bytes_decoded",
+        "trigrams_counted",
+        "cache_hits",
+        "cache_misses",
+    };
+
+    const char* const HISTOGRAM_NAMES[HISTOGRAM_NUM] = {
+        "profile_size",
+        "score_margin_ppm",
+        "decode_latency_ns",
+        "profile_latency_ns",
+        "normalize_latency_ns",
+        "score_latency_ns",
+    };
+
+    struct HistogramData {
+        atomic<uint64_t> count{0};
+        atomic<uint64_t> sum{0};
+        atomic<uint64_t> buckets[HISTOGRAM_BUCKETS] = {};
+    };
+
+    struct MetricsShard {
+        atomic<uint64_t> counters[COUNTER_NUM] = {};
+        HistogramData histograms[HISTOGRAM_NUM];
+    };
+
+    /**
+     * @brief Adds every value of one shard into another.
+     */
+    void mergeShard(const MetricsShard& from, MetricsShard& to) {
+        for (size_t i = 0; i < COUNTER_NUM; ++i)
+            to.counters[i].fetch_add(from.counters[i].load(memory_order_relaxed), memory_order_relaxed);
+
+        for (size_t i = 0; i < HISTOGRAM_NUM; ++i) {
+            const HistogramData& source = from.histograms[i];
+            HistogramData& destination = to.histograms[i];
+
+            destination.count.fetch_add(source.count.load(memory_order_relaxed), memory_order_relaxed);
+            destination.sum.fetch_add(source.sum.load(memory_order_relaxed), memory_order_relaxed);
+            for (size_t j = 0; j < HISTOGRAM_BUCKETS; ++j)
+                destination.buckets[j].fetch_add(source.buckets[j].load(memory_order_relaxed),
+                                                 memory_order_relaxed);
+        }
+    }
+
+    struct MetricsRegistry {
+        mutex lock;
+        vector<MetricsShard*> shards;
+        MetricsShard retired;   // Totals of threads that already exited
+    };
+
+    MetricsRegistry& getRegistry() {
+        static MetricsRegistry registry;
+        return registry;
+    }
+
+    /**
+     * @brief Registers the shard of the current thread, and folds it into the
+     *        retired totals when the thread exits.
+     */
+    struct ThreadShard {
+        MetricsShard shard;
+
+        ThreadShard() {
+            MetricsRegistry& registry = getRegistry();
+            lock_guard<mutex> guard(registry.lock);
+            registry.shards.push_back(&shard);
+        }
+
+        ~ThreadShard() {
+            MetricsRegistry& registry = getRegistry();
+            lock_guard<mutex> guard(registry.lock);
+            mergeShard(shard, registry.retired);
+            registry.shards.erase(find(registry.shards.begin(), registry.shards.end(), &shard));
+        }
+    };
+
+    inline MetricsShard& getThreadShard() {
+        thread_local ThreadShard threadShard;
+        return threadShard.shard;
+    }
+
+    inline size_t getBucketIndex(uint64_t value) noexcept {
+        return value ? 64 - __builtin_clzll(value) : 0;
+    }
+}
+
+/**
+ * @brief Increments a counter.
+ * @param counter The counter
+ * @param value Amount to add
+ */
+void addMetric(MetricCounter counter, uint64_t value)
+{
+    getThreadShard().counters[(size_t)counter].fetch_add(value, memory_order_relaxed);
+}
+
+/**
+ * @brief Records a value into a histogram.
+ * @param histogram The histogram
+ * @param value The value
+ */
+void recordMetric(MetricHistogram histogram, uint64_t value)
+{
+    HistogramData& data = getThreadShard().histograms[(size_t)histogram];
+
+    data.count.fetch_add(1, memory_order_relaxed);
+    data.sum.fetch_add(value, memory_order_relaxed);
+    data.buckets[getBucketIndex(value)].fetch_add(1, memory_order_relaxed);
+}
+
+/**
+ * @brief Adds up one counter over all threads.
+ * @param counter The counter
+ * @return uint64_t Its total
+ */
+uint64_t getMetricCount(MetricCounter counter)
+{
+    MetricsRegistry& registry = getRegistry();
+    lock_guard<mutex> guard(registry.lock);
+
+    uint64_t count = registry.retired.counters[(size_t)counter].load(memory_order_relaxed);
+    for (const MetricsShard* shard : registry.shards)
+        count += shard->counters[(size_t)counter].load(memory_order_relaxed);
+    return count;
+}
+
+/**
+ * @brief Aggregates all threads' metrics as a JSON object.
+ *
+ * Histograms list only their non-empty buckets, each one with the inclusive
+ * upper bound ("le") of the values it holds.
+ *
+ * @return string The JSON document
+ */
+string getMetricsJSON()
+{
+    MetricsShard total;
+    {
+        MetricsRegistry& registry = getRegistry();
+        lock_guard<mutex> guard(registry.lock);
+
+        mergeShard(registry.retired, total);
+        for (const MetricsShard* shard : registry.shards)
+            mergeShard(*shard, total);
+    }
+
+    string json = "{\"counters\":{";
+    for (size_t i = 0; i < COUNTER_NUM; ++i)
+    {
+        if (i)
+            json += ',';
+        json += '"' + string(COUNTER_NAMES[i]) + "\":" +
+                to_string(total.counters[i].load(memory_order_relaxed));
+    }
+
+    json += "},\"histograms\":{";
+    for (size_t i = 0; i < HISTOGRAM_NUM; ++i)
+    {
+        const HistogramData& data = total.histograms[i];
+
+        if (i)
+            json += ',';
+        json += '"' + string(HISTOGRAM_NAMES[i]) + "\":{\"count\":" +
+                to_string(data.count.load(memory_order_relaxed)) + ",\"sum\":" +
+                to_string(data.sum.load(memory_order_relaxed)) + ",\"buckets\":[";
+
+        bool isFirstBucket = true;
+        for (size_t j = 0; j < HISTOGRAM_BUCKETS; ++j)
+        {
+            uint64_t count = data.buckets[j].load(memory_order_relaxed);
+            if (!count)
+                continue;
+
+            uint64_t upperBound = j ? (j == 64 ? UINT64_MAX : (uint64_t(1) << j) - 1) : 0;
+            if (!isFirstBucket)
+                json += ',';
+            isFirstBucket = false;
+            json += "{\"le\":" + to_string(upperBound) + ",\"count\":" + to_string(count) + '}';
+        }
+        json += "]}";
+    }
+    json += "}}";
+
+    return json;
+}
@@ -0,0 +1,70 @@
+/**
+ * @brief Lequel? hot-path metrics (counters and histograms)
+ * @author Dylan Frigerio, Micaela Dinsen
+ *
+ * @copyright Copyright (c) 2022-2023
+ *
+ * Every thread updates its own shard of relaxed atomics, so recording a
+ * value never contends with other threads. getMetricsJSON() adds up all
+ * live shards plus the totals left behind by threads that already exited.
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+enum class MetricCounter
+{
+    DocumentsProcessed,
+    BytesDecoded,
+    TrigramsCounted,
+    CacheHits,
+    CacheMisses,
+    Count
+};
+
+enum class MetricHistogram
+{
+    ProfileSize,        // Unique trigrams per text profile
+    ScoreMargin,        // Best minus second best similarity, in millionths
+    DecodeLatency,      // UTF-8 decode, lowercasing and line split (ns)
+    ProfileLatency,     // Trigram extraction and counting (ns)
+    NormalizeLatency,   // Text profile normalization (ns)
+    ScoreLatency,       // Similarity against every language (ns)
+    Count
+};
+
+// Functions
+void addMetric(MetricCounter counter, uint64_t value = 1);
+void recordMetric(MetricHistogram histogram, uint64_t value);
+uint64_t getMetricCount(MetricCounter counter);
+std::string getMetricsJSON();
+
+/**
+ * @brief Records the lifetime of a scope (in ns) into a latency histogram.
+ */
+class MetricTimer
+{
+public:
+    explicit MetricTimer(MetricHistogram histogram)
+        : histogram(histogram), startTime(std::chrono::steady_clock::now()) {}
+
+    ~MetricTimer()
+    {
+        auto elapsed = std::chrono::steady_clock::now() - startTime;
+        recordMetric(histogram,
+            (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+    }
+
+    MetricTimer(const MetricTimer &) = delete;
+    MetricTimer &operator=(const MetricTimer &) = delete;
+
+private:
+    MetricHistogram histogram;
+    std::chrono::steady_clock::time_point startTime;
+};
+
+#endif
@@ -0,0 +1,457 @@
+/**
+ * @brief Lequel? language model loading
+ * @author Marc S. Ressl
+ * @modified Dylan Frigerio, Micaela Dinsen
+ *
+ * @copyright Copyright (c) 2022-2023
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <memory>
+
+#include <sys/stat.h>
+
+#include "CSVData.h"
+#include "Model.h"
+#include "Probes.h"
+#include "Trace.h"
+#include "TrigramVocabulary.h"
+
+using namespace std;
+
+const string LANGUAGECODE_NAMES_FILE = "resources/languagecode_names_es.csv";
+const string TRIGRAMS_PATH = "resources/trigrams/";
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+const bool IS_BIG_ENDIAN_HOST = true;
+#else
+const bool IS_BIG_ENDIAN_HOST = false;
+#endif
+
+/**
+ * @brief Converts a field of a binary profile between little-endian and the
+ *        host byte order (a no-op on little-endian hosts).
+ */
+static uint32_t swapLittleEndian(uint32_t value)
+{
+    return IS_BIG_ENDIAN_HOST ? __builtin_bswap32(value) : value;
+}
+
+static uint64_t swapLittleEndian(uint64_t value)
+{
+    return IS_BIG_ENDIAN_HOST ? __builtin_bswap64(value) : value;
+}
+
+/**
+ * @brief Reads a binary trigram profile.
+ *
+ * Profiles written with the legacy UTF-16 packing are migrated to the
+ * current packing; rows that cannot be migrated are dropped.
+ *
+ * @param path The filename
+ * @param frequencies Destination rows
+ * @param maxRows Read only this many rows, the most frequent (0: read them all)
+ * @return Function succeeded
+ */
+bool readBinaryProfile(const string path, TrigramFrequencies& frequencies, size_t maxRows)
+{
+    TRACE_SCOPE("read binary profile", path);
+    ifstream file(path, ios::binary);
+
+    if (!file.is_open())
+        return false;
+
+    char magic[4];
+    uint32_t version, packing;
+    uint64_t rowNum;
+
+    file.read(magic, sizeof(magic));
+    file.read((char*)&version, sizeof(version));
+    file.read((char*)&packing, sizeof(packing));
+    file.read((char*)&rowNum, sizeof(rowNum));
+
+    version = swapLittleEndian(version);
+    packing = swapLittleEndian(packing);
+    rowNum = swapLittleEndian(rowNum);
+
+    if (!file || memcmp(magic, BINARY_PROFILE_MAGIC, sizeof(magic)) ||
+        version != BINARY_PROFILE_VERSION)
+        return false;
+
+    const bool isLegacyPacking = (packing == (uint32_t)TrigramPacking::UTF16);
+    if (!isLegacyPacking && packing != (uint32_t)TRIGRAM_PACKING)
+        return false;
+
+    // Reject truncated files before allocating the rows
+    streampos rowsStart = file.tellg();
+    file.seekg(0, ios::end);
+    if ((uint64_t)(file.tellg() - rowsStart) / sizeof(frequencies[0]) < rowNum)
+        return false;
+    file.seekg(rowsStart);
+
+    if (maxRows && rowNum > maxRows)
+        rowNum = maxRows;
+
+    frequencies.resize(rowNum);
+    file.read((char*)frequencies.data(), rowNum * sizeof(frequencies[0]));
+    if (!file)
+        return false;
+
+    if (IS_BIG_ENDIAN_HOST)
+    {
+        for (auto& [trigram, count] : frequencies)
+        {
+            trigram = swapLittleEndian((uint64_t)trigram);
+            count = swapLittleEndian((uint64_t)count);
+        }
+    }
+
+    if (isLegacyPacking)
+    {
+        size_t validRowNum = 0;
+        for (auto& [trigram, count] : frequencies)
+        {
+            uint64_t migratedTrigram = migrateUtf16Trigram(trigram);
+            if (migratedTrigram)
+                frequencies[validRowNum++] = { migratedTrigram, count };
+        }
+        frequencies.resize(validRowNum);
+    }
+
+    return true;
+}
+
+/**
+ * @brief Writes a binary trigram profile (with the current packing).
+ *
+ * @param path The filename
+ * @param frequencies The rows
+ * @return Function succeeded
+ */
+bool writeBinaryProfile(const string path, const TrigramFrequencies& frequencies)
+{
+    ofstream file(path, ios::binary);
+
+    if (!file.is_open())
+        return false;
+
+    const uint32_t version = swapLittleEndian(BINARY_PROFILE_VERSION);
+    const uint32_t packing = swapLittleEndian((uint32_t)TRIGRAM_PACKING);
+    const uint64_t rowNum = swapLittleEndian((uint64_t)frequencies.size());
+
+    file.write(BINARY_PROFILE_MAGIC, sizeof(BINARY_PROFILE_MAGIC));
+    file.write((const char*)&version, sizeof(version));
+    file.write((const char*)&packing, sizeof(packing));
+    file.write((const char*)&rowNum, sizeof(rowNum));
+
+    if (!IS_BIG_ENDIAN_HOST)
+        file.write((const char*)frequencies.data(), frequencies.size() * sizeof(frequencies[0]));
+    else
+    {
+        for (auto& [trigram, count] : frequencies)
+        {
+            const uint64_t row[2] = {swapLittleEndian((uint64_t)trigram), swapLittleEndian((uint64_t)count)};
+            file.write((const char*)row, sizeof(row));
+        }
+    }
+
+    return file.good();
+}
+
+/**
+ * @brief Loads the profile of one language.
+ * @param languageCode ISO code of the language
+ * @param maxTrigrams Keep only the most frequent trigrams (SIZE_MAX: all)
+ * @param language Destination profile (normalized)
+ * @return Function succeeded
+ */
+static bool loadLanguageProfile(const string& languageCode, size_t maxTrigrams,
+                                LanguageProfile& language)
+{
+    TRACE_SCOPE("load profile", languageCode);
+    language.languageCode = languageCode;
+
+    // Prefer the binary profile written by lequel-train, if there is one
+    TrigramProfile profile;
+    TrigramFrequencies frequencies;
+    // Rows are sorted by frequency, so reading the first ones keeps the top ones
+    if (readBinaryProfile(TRIGRAMS_PATH + languageCode + ".bin", frequencies, maxTrigrams))
+    {
+        for (auto& [trigramInt, frequency] : frequencies)
+            profile[trigramInt] = (float)frequency;
+    }
+    else
+    {
+        CSVData languageCSVData;
+        if (!readCSV(TRIGRAMS_PATH + languageCode + ".csv", languageCSVData))
+            return false;
+
+        // Convert each trigram string to uint64_t
+        for (auto& fields : languageCSVData)
+        {
+            if (profile.size() >= maxTrigrams)
+                break;
+            if (fields.size() != 2)
+                continue;
+
+            string trigramString = fields[0];
+            float frequency = (float)stoi(fields[1]);
+
+            uint64_t trigramInt = stringTrigramToInt(trigramString);
+            if (trigramInt != 0) {
+                profile[trigramInt] = frequency;
+            }
+        }
+    }
+
+    normalizeTrigramProfile(profile);
+    getTrigramVocabulary().intern(profile, language.idProfile);
+    return true;
+}
+
+/**
+ * @brief Loads all language profiles from CSV files.
+ * @param languageCodeNames Map of ISO code → language name
+ * @param languages Output vector of language profiles
+ * @param maxTrigrams Keep only the most frequent trigrams of each language
+ *                    (0: keep them all)
+ * @param progress Optional counters of languages in the index and loaded
+ *                 so far, for a progress bar on another thread, and flag
+ *                 to cancel the load from it
+ * @return Function succeeded (false if cancelled)
+ */
+bool loadLanguagesData(map<string, string>& languageCodeNames, LanguageProfiles& languages,
+                       size_t maxTrigrams, ModelLoadProgress* progress)
+{
+    TRACE_SCOPE("load model");
+    const uint64_t startTime = LEQUEL_PROBE_TIME(model_loaded);
+    if (!maxTrigrams)
+        maxTrigrams = SIZE_MAX;
+
+    CSVData languageCodesCSVData;
+    if (!readCSV(LANGUAGECODE_NAMES_FILE, languageCodesCSVData))
+        return false;
+
+    if (progress)
+    {
+        size_t languageCount = count_if(languageCodesCSVData.begin(), languageCodesCSVData.end(),
+                                        [](const auto& fields) { return fields.size() == 2; });
+        progress->languageCount.store(languageCount, memory_order_relaxed);
+    }
+
+    // Iterate through CSV rows (code, name)
+    for (auto& fields : languageCodesCSVData)
+    {
+        if (fields.size() != 2)
+            continue;
+        if (progress && progress->isCancelled.load(memory_order_relaxed))
+            return false;
+
+        string languageCode = fields[0];
+        string languageName = fields[1];
+        languageCodeNames[languageCode] = languageName;
+
+        languages.push_back(LanguageProfile());
+        if (!loadLanguageProfile(languageCode, maxTrigrams, languages.back()))
+            return false;
+
+        if (progress)
+            progress->loadedCount.fetch_add(1, memory_order_relaxed);
+    }
+
+    LEQUEL_PROBE3(model_loaded, languages.size(), getModelMemoryUsage(languages), getProbeDuration(startTime));
+    return true;
+}
+
+/**
+ * @brief Reads the language index and the script signature of every language.
+ *
+ * The signature comes from the first SCRIPT_SIGNATURE_ROWS rows of each
+ * profile only; full profiles are loaded later, on demand.
+ *
+ * @param languageCodeNames Map of ISO code → language name
+ * @param maxTrigrams Keep only the most frequent trigrams of each language
+ *                    (0: keep them all)
+ * @return Function succeeded
+ */
+bool LazyModel::open(map<string, string>& languageCodeNames, size_t maxTrigrams)
+{
+    TRACE_SCOPE("open lazy model");
+    this->maxTrigrams = maxTrigrams ? maxTrigrams : SIZE_MAX;
+    entries.clear();
+
+    CSVData languageCodesCSVData;
+    if (!readCSV(LANGUAGECODE_NAMES_FILE, languageCodesCSVData))
+        return false;
+
+    for (auto& fields : languageCodesCSVData)
+    {
+        if (fields.size() != 2)
+            continue;
+
+        const string& languageCode = fields[0];
+        languageCodeNames[languageCode] = fields[1];
+
+        auto entry = make_unique<Entry>();
+        entry->profile.languageCode = languageCode;
+
+        TrigramFrequencies frequencies;
+        CSVData languageCSVData;
+        if (readBinaryProfile(TRIGRAMS_PATH + languageCode + ".bin", frequencies, SCRIPT_SIGNATURE_ROWS))
+        {
+            for (auto& [trigram, frequency] : frequencies)
+                entry->scriptMask |= getTrigramScriptMask(trigram);
+        }
+        else if (readCSV(TRIGRAMS_PATH + languageCode + ".csv", languageCSVData, SCRIPT_SIGNATURE_ROWS))
+        {
+            for (auto& row : languageCSVData)
+            {
+                if (row.size() == 2)
+                    entry->scriptMask |= getTrigramScriptMask(stringTrigramToInt(row[0]));
+            }
+        }
+        else
+            return false;
+
+        entries.push_back(move(entry));
+    }
+    return true;
+}
+
+/**
+ * @brief Returns a language profile, loading it on first use.
+ *
+ * Safe to call from several threads: the profile is loaded exactly once.
+ *
+ * @param index Index of the language, in [0, getLanguageCount())
+ * @return const LanguageProfile* The profile, or nullptr if it failed to load
+ */
+const LanguageProfile* LazyModel::getProfile(size_t index)
+{
+    Entry& entry = *entries[index];
+
+    call_once(entry.loadFlag, [&]() {
+        entry.isLoaded = loadLanguageProfile(entry.profile.languageCode, maxTrigrams, entry.profile);
+        if (entry.isLoaded)
+            loadedCount.fetch_add(1, memory_order_relaxed);
+    });
+
+    return entry.isLoaded ? &entry.profile : nullptr;
+}
+
+/**
+ * @brief Selects the languages that share a script with the text, and
+ *        loads their profiles.
+ *
+ * If the text has no script-specific characters at all, every language is
+ * a candidate.
+ *
+ * @param text The text to identify
+ * @return LanguageCandidates Loaded candidate profiles
+ */
+LanguageCandidates LazyModel::getCandidates(const Text& text)
+{
+    const uint64_t textMask = getScriptMask(text);
+    LanguageCandidates candidates;
+
+    for (size_t i = 0; i < entries.size(); i++)
+    {
+        if (textMask && !(entries[i]->scriptMask & textMask))
+            continue;
+
+        if (const LanguageProfile* profile = getProfile(i))
+            candidates.push_back(profile);
+    }
+    return candidates;
+}
+
+/**
+ * @brief Estimates the heap memory used by the language profiles.
+ *
+ * Counts the (id, weight) array of each profile and the vocabulary entries
+ * they reference: the shared vocabulary also holds the trigrams of models
+ * loaded before, which are not part of this one. Allocator overhead is not
+ * included.
+ *
+ * @param languages The language profiles
+ * @return size_t Estimated size in bytes
+ */
+size_t getModelMemoryUsage(const LanguageProfiles& languages)
+{
+    size_t size = languages.capacity() * sizeof(LanguageProfile);
+
+    vector<TrigramId> ids;
+    for (const auto& language : languages)
+    {
+        size += language.idProfile.capacity() * sizeof(TrigramIdWeight);
+        for (const TrigramIdWeight& entry : language.idProfile)
+            ids.push_back(entry.id);
+    }
+    sort(ids.begin(), ids.end());
+    const size_t trigramNum = unique(ids.begin(), ids.end()) - ids.begin();
+
+    return size + trigramNum * TrigramVocabulary::getEntrySize();
+}
+
+/**
+ * @brief Folds a value into a running 64-bit hash.
+ */
+static uint64_t combineHash(uint64_t hash, uint64_t value)
+{
+    hash ^= value + 0x9E3779B97F4A7C15 + (hash << 6) + (hash >> 2);
+    hash ^= hash >> 31;
+    hash *= 0xBF58476D1CE4E5B9;
+    return hash ^ (hash >> 29);
+}
+
+static uint64_t combineHash(uint64_t hash, const string& value)
+{
+    hash = combineHash(hash, value.size());
+    for (unsigned char c : value)
+        hash = combineHash(hash, c);
+    return hash;
+}
+
+/**
+ * @brief Identifies the exact model that loadLanguagesData would load.
+ *
+ * Hashes the identity (inode, size and modification time) of the language
+ * index and of every profile file, plus the settings that change the loaded
+ * profiles or the results. Profiles are not read, so this is cheap even for
+ * a LazyModel.
+ *
+ * @param languageCodeNames Map of ISO code → language name
+ * @param maxTrigrams Kept trigrams per language (0: all)
+ * @param settings Any other setting that changes the results
+ * @return uint64_t The model version (changes when any of them changes)
+ */
+uint64_t getModelVersion(const map<string, string>& languageCodeNames, size_t maxTrigrams,
+                         const string& settings)
+{
+    uint64_t version = combineHash((uint64_t)TRIGRAM_PACKING, maxTrigrams ? maxTrigrams : SIZE_MAX);
+    version = combineHash(version, settings);
+
+    auto combineFile = [&](const string& path) {
+        struct stat fileStat;
+        if (stat(path.c_str(), &fileStat) < 0)
+            return false;
+
+        version = combineHash(version, path);
+        version = combineHash(version, (uint64_t)fileStat.st_ino);
+        version = combineHash(version, (uint64_t)fileStat.st_size);
+        version = combineHash(version, (uint64_t)fileStat.st_mtim.tv_sec);
+        version = combineHash(version, (uint64_t)fileStat.st_mtim.tv_nsec);
+        return true;
+    };
+
+    combineFile(LANGUAGECODE_NAMES_FILE);
+    for (auto& [languageCode, languageName] : languageCodeNames)
+    {
+        // Same preference as loadLanguageProfile
+        if (!combineFile(TRIGRAMS_PATH + languageCode + ".bin"))
+            combineFile(TRIGRAMS_PATH + languageCode + ".csv");
+    }
+    return version;
+}
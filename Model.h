@@ -0,0 +1,89 @@
+/**
+ * @brief Lequel? language model loading
+ * @author Marc S. Ressl
+ * @modified Dylan Frigerio, Micaela Dinsen
+ *
+ * @copyright Copyright (c) 2022-2023
+ */
+
+#ifndef MODEL_H
+#define MODEL_H
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "Lequel.h"
+
+extern const std::string LANGUAGECODE_NAMES_FILE;
+extern const std::string TRIGRAMS_PATH;
+
+// TrigramFrequencies: (trigram, count) rows of a profile, most frequent first
+typedef std::vector<std::pair<uint64_t, uint64_t>> TrigramFrequencies;
+
+// Binary profile file: "LQTP" magic, uint32 format version, uint32
+// TrigramPacking, uint64 row count, then (uint64 trigram, uint64 count)
+// rows, all in little-endian byte order
+const char BINARY_PROFILE_MAGIC[4] = {'L', 'Q', 'T', 'P'};
+const uint32_t BINARY_PROFILE_VERSION = 1;
+
+// Number of top profile rows that make up a language's script signature
+const size_t SCRIPT_SIGNATURE_ROWS = 100;
+
+/**
+ * @brief Language model that loads profiles on first use.
+ *
+ * open() reads only the language index and a script signature per
+ * language; getCandidates() narrows the languages down to those sharing a
+ * script with the text and loads just their profiles.
+ */
+class LazyModel
+{
+public:
+    bool open(std::map<std::string, std::string> &languageCodeNames, size_t maxTrigrams = 0);
+
+    size_t getLanguageCount() const { return entries.size(); }
+    size_t getLoadedCount() const { return loadedCount.load(std::memory_order_relaxed); }
+
+    const LanguageProfile *getProfile(size_t index);
+    LanguageCandidates getCandidates(const Text &text);
+
+private:
+    struct Entry
+    {
+        LanguageProfile profile;
+        uint64_t scriptMask = 0;
+        std::once_flag loadFlag;
+        bool isLoaded = false;
+    };
+
+    std::vector<std::unique_ptr<Entry>> entries;
+    size_t maxTrigrams = SIZE_MAX;
+    std::atomic<size_t> loadedCount{0};
+};
+
+// Progress of loadLanguagesData, readable from other threads while it runs;
+// setting isCancelled stops it before the next language
+struct ModelLoadProgress
+{
+    std::atomic<size_t> languageCount{0};
+    std::atomic<size_t> loadedCount{0};
+    std::atomic<bool> isCancelled{false};
+};
+
+// Functions
+bool readBinaryProfile(const std::string path, TrigramFrequencies &frequencies, size_t maxRows = 0);
+bool writeBinaryProfile(const std::string path, const TrigramFrequencies &frequencies);
+bool loadLanguagesData(std::map<std::string, std::string> &languageCodeNames,
+                       LanguageProfiles &languages, size_t maxTrigrams = 0,
+                       ModelLoadProgress *progress = nullptr);
+size_t getModelMemoryUsage(const LanguageProfiles &languages);
+uint64_t getModelVersion(const std::map<std::string, std::string> &languageCodeNames,
+                         size_t maxTrigrams = 0, const std::string &settings = "");
+
+#endif
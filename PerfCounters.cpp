@@ -0,0 +1,292 @@
+/**
+ * @brief Lequel? hardware performance counters per engine stage
+ * @author Dylan Frigerio, Micaela Dinsen
+ *
+ * @copyright Copyright (c) 2022-2023
+ */
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "PerfCounters.h"
+
+using namespace std;
+
+atomic<bool> perfCountersEnabled{false};
+
+namespace
+{
+    const size_t STAGE_NUM = (size_t)PerfStage::Count;
+
+    const char *const STAGE_NAMES[STAGE_NUM] = {
+        "decode",
+        "profile",
+        "normalize",
+        "score",
+    };
+
+    const char *const EVENT_NAMES[PERF_EVENT_NUM] = {
+        "task clock",
+        "cycles",
+        "instructions",
+        "L1D read misses",
+        "LLC misses",
+        "branch misses",
+    };
+
+    struct EventConfig
+    {
+        uint32_t type;
+        uint64_t config;
+    };
+
+    const EventConfig EVENT_CONFIGS[PERF_EVENT_NUM] = {
+        {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+        {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                                 (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    };
+
+    struct StageTotals
+    {
+        atomic<uint64_t> scopeCount{0};
+        atomic<uint64_t> values[PERF_EVENT_NUM] = {};
+    };
+
+    StageTotals stageTotals[STAGE_NUM];
+
+    // Events that opened on some thread (bit i: PerfEvent i)
+    atomic<uint32_t> openedEvents{0};
+
+    int openEvent(size_t event, int groupFd)
+    {
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = EVENT_CONFIGS[event].type;
+        attr.config = EVENT_CONFIGS[event].config;
+        attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        // User space only: allowed up to perf_event_paranoid 2
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+
+        return (int)syscall(SYS_perf_event_open, &attr, 0, -1, groupFd, PERF_FLAG_FD_CLOEXEC);
+    }
+
+    /**
+     * @brief Counter group of one thread (it counts only that thread).
+     */
+    struct ThreadCounters
+    {
+        int fds[PERF_EVENT_NUM];
+        size_t groupEvents[PERF_EVENT_NUM]; // Event of each value of a group read
+        size_t groupSize = 0;
+        bool isOpened = false;
+        int leaderError = 0;
+        int errors[PERF_EVENT_NUM] = {};
+
+        ThreadCounters()
+        {
+            fill(begin(fds), end(fds), -1);
+        }
+
+        ~ThreadCounters()
+        {
+            for (int fd : fds)
+            {
+                if (fd >= 0)
+                    close(fd);
+            }
+        }
+
+        bool open()
+        {
+            if (isOpened)
+                return fds[0] >= 0;
+            isOpened = true;
+
+            for (size_t event = 0; event < PERF_EVENT_NUM; event++)
+            {
+                fds[event] = openEvent(event, event ? fds[0] : -1);
+                if (fds[event] < 0)
+                {
+                    errors[event] = errno;
+                    // Without the leader there is no group
+                    if (!event)
+                        return false;
+                    continue;
+                }
+
+                groupEvents[groupSize++] = event;
+                openedEvents.fetch_or(1u << event, memory_order_relaxed);
+            }
+            return true;
+        }
+
+        /**
+         * @brief Reads the group, scaling counts that were multiplexed.
+         */
+        bool read(uint64_t values[PERF_EVENT_NUM])
+        {
+            uint64_t data[3 + PERF_EVENT_NUM];
+            if (::read(fds[0], data, sizeof(data)) < (ssize_t)((3 + groupSize) * sizeof(uint64_t)))
+                return false;
+
+            const uint64_t enabledTime = data[1];
+            const uint64_t runningTime = data[2];
+
+            fill(values, values + PERF_EVENT_NUM, 0);
+            for (size_t i = 0; i < groupSize; i++)
+            {
+                uint64_t value = data[3 + i];
+                if (runningTime && runningTime < enabledTime)
+                    value = (uint64_t)((double)value * enabledTime / runningTime);
+                values[groupEvents[i]] = value;
+            }
+            return true;
+        }
+    };
+
+    thread_local ThreadCounters threadCounters;
+
+    /**
+     * @brief Appends a right-aligned column, or "n/a" if it cannot be computed.
+     */
+    void appendColumn(string &report, const char *format, double value, bool isAvailable)
+    {
+        char column[32];
+        if (isAvailable)
+            snprintf(column, sizeof(column), format, value);
+        else
+            snprintf(column, sizeof(column), " %12s", "n/a");
+        report += column;
+    }
+}
+
+/**
+ * @brief Turns counting on, after checking that the kernel allows it.
+ *
+ * @return Whether counters are available (if not, the reason is written to
+ *         stderr and scopes keep doing nothing)
+ */
+bool startPerfCounters()
+{
+    ThreadCounters &counters = threadCounters;
+    if (!counters.open())
+    {
+        fprintf(stderr, "Performance counters unavailable: %s (see /proc/sys/kernel/perf_event_paranoid)\n",
+                strerror(counters.errors[0]));
+        return false;
+    }
+
+    for (size_t event = 1; event < PERF_EVENT_NUM; event++)
+    {
+        if (counters.fds[event] < 0)
+            fprintf(stderr, "Performance counter %s unavailable: %s\n", EVENT_NAMES[event],
+                    strerror(counters.errors[event]));
+    }
+
+    perfCountersEnabled.store(true, memory_order_release);
+    return true;
+}
+
+void stopPerfCounters()
+{
+    perfCountersEnabled.store(false, memory_order_release);
+}
+
+/**
+ * @brief Clears the totals of every stage.
+ */
+void resetPerfCounters()
+{
+    for (StageTotals &totals : stageTotals)
+    {
+        totals.scopeCount.store(0, memory_order_relaxed);
+        for (auto &value : totals.values)
+            value.store(0, memory_order_relaxed);
+    }
+}
+
+void PerfScope::begin(PerfStage stage)
+{
+    ThreadCounters &counters = threadCounters;
+    if (!counters.open() || !counters.read(startValues))
+        return;
+
+    this->stage = stage;
+    isActive = true;
+}
+
+void PerfScope::end()
+{
+    uint64_t endValues[PERF_EVENT_NUM];
+    if (!threadCounters.read(endValues))
+        return;
+
+    StageTotals &totals = stageTotals[(size_t)stage];
+    totals.scopeCount.fetch_add(1, memory_order_relaxed);
+    for (size_t event = 0; event < PERF_EVENT_NUM; event++)
+        totals.values[event].fetch_add(endValues[event] - startValues[event], memory_order_relaxed);
+}
+
+/**
+ * @brief Formats the totals of every stage that ran as a table: CPU time,
+ *        cycles per trigram, instructions per cycle and misses per trigram.
+ *
+ * High IPC with few cache misses per trigram means a stage is compute bound;
+ * low IPC with many LLC misses means it waits on memory.
+ *
+ * @param trigramCount Trigrams counted over the same period (the
+ *                     trigrams_counted metric), for the per-trigram columns
+ * @return string The table
+ */
+string getPerfReport(uint64_t trigramCount)
+{
+    const uint32_t events = openedEvents.load(memory_order_relaxed);
+    auto isOpened = [&](PerfEvent event) { return (events >> (size_t)event) & 1; };
+
+    string report;
+    char line[160];
+    snprintf(line, sizeof(line), "%-10s %10s %12s %12s %12s %12s %12s %12s\n", "stage", "scopes", "cpu ms",
+             "cycles/tri", "IPC", "L1D miss/tri", "LLC miss/tri", "br miss/tri");
+    report += line;
+
+    const double trigrams = (double)trigramCount;
+    for (size_t stage = 0; stage < STAGE_NUM; stage++)
+    {
+        const StageTotals &totals = stageTotals[stage];
+        const uint64_t scopeCount = totals.scopeCount.load(memory_order_relaxed);
+        if (!scopeCount)
+            continue;
+
+        double values[PERF_EVENT_NUM];
+        for (size_t event = 0; event < PERF_EVENT_NUM; event++)
+            values[event] = (double)totals.values[event].load(memory_order_relaxed);
+
+        const double cycles = values[(size_t)PerfEvent::Cycles];
+
+        snprintf(line, sizeof(line), "%-10s %10llu", STAGE_NAMES[stage], (unsigned long long)scopeCount);
+        report += line;
+        appendColumn(report, " %12.2f", values[(size_t)PerfEvent::TaskClock] / 1e6, true);
+        appendColumn(report, " %12.1f", cycles / trigrams, isOpened(PerfEvent::Cycles) && trigramCount);
+        appendColumn(report, " %12.2f", values[(size_t)PerfEvent::Instructions] / cycles,
+                     isOpened(PerfEvent::Instructions) && isOpened(PerfEvent::Cycles) && cycles > 0);
+        appendColumn(report, " %12.3f", values[(size_t)PerfEvent::L1DMisses] / trigrams,
+                     isOpened(PerfEvent::L1DMisses) && trigramCount);
+        appendColumn(report, " %12.3f", values[(size_t)PerfEvent::LLCMisses] / trigrams,
+                     isOpened(PerfEvent::LLCMisses) && trigramCount);
+        appendColumn(report, " %12.3f", values[(size_t)PerfEvent::BranchMisses] / trigrams,
+                     isOpened(PerfEvent::BranchMisses) && trigramCount);
+        report += '\n';
+    }
+    return report;
+}
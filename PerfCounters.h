@@ -0,0 +1,92 @@
+/**
+ * @brief Lequel? hardware performance counters per engine stage
+ * @author Dylan Frigerio, Micaela Dinsen
+ *
+ * @copyright Copyright (c) 2022-2023
+ *
+ * startPerfCounters() turns on counting with perf_event_open(2). Each thread
+ * opens its own counter group the first time it enters a PerfScope; the
+ * scope reads the group on entry and exit and adds the difference to its
+ * stage. The group leader is the task clock (a software event), and every
+ * hardware event is optional, so virtual machines without a PMU still get
+ * per-stage CPU time. While counting is off, a scope costs one relaxed
+ * atomic load.
+ *
+ * @cite https://man7.org/linux/man-pages/man2/perf_event_open.2.html
+ */
+
+#ifndef PERFCOUNTERS_H
+#define PERFCOUNTERS_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+enum class PerfStage
+{
+    Decode,     // UTF-8 decode, lowercasing and line split
+    Profile,    // Trigram extraction and counting
+    Normalize,  // Text profile normalization
+    Score,      // Similarity against every language
+    Count
+};
+
+enum class PerfEvent
+{
+    TaskClock,      // ns on CPU
+    Cycles,
+    Instructions,
+    L1DMisses,      // L1 data cache read misses
+    LLCMisses,      // Last level cache misses
+    BranchMisses,
+    Count
+};
+
+const size_t PERF_EVENT_NUM = (size_t)PerfEvent::Count;
+
+extern std::atomic<bool> perfCountersEnabled;
+
+// Functions
+bool startPerfCounters();
+void stopPerfCounters();
+void resetPerfCounters();
+std::string getPerfReport(uint64_t trigramCount);
+
+inline bool isPerfCounting()
+{
+    return perfCountersEnabled.load(std::memory_order_relaxed);
+}
+
+/**
+ * @brief Adds the counter values of a scope's lifetime to a stage.
+ *
+ * Nesting two scopes on the same thread counts the inner one twice.
+ */
+class PerfScope
+{
+public:
+    explicit PerfScope(PerfStage stage)
+    {
+        if (isPerfCounting())
+            begin(stage);
+    }
+
+    ~PerfScope()
+    {
+        if (isActive)
+            end();
+    }
+
+    PerfScope(const PerfScope &) = delete;
+    PerfScope &operator=(const PerfScope &) = delete;
+
+private:
+    void begin(PerfStage stage);
+    void end();
+
+    bool isActive = false;
+    PerfStage stage;
+    uint64_t startValues[PERF_EVENT_NUM];
+};
+
+#endif
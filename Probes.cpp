@@ -0,0 +1,23 @@
+/**
+ * @brief Lequel? USDT (statically defined) tracepoints
+ * @author Dylan Frigerio, Micaela Dinsen
+ *
+ * @copyright Copyright (c) 2022-2023
+ */
+
+#include "Probes.h"
+
+#ifdef LEQUEL_HAS_PROBES
+
+// The probe notes point at these; tracers find them in the .probes section
+#define LEQUEL_PROBE_SEMAPHORE(name) \
+    __extension__ volatile unsigned short lequel_##name##_semaphore __attribute__((unused, section(".probes")))
+
+LEQUEL_PROBE_SEMAPHORE(document_start);
+LEQUEL_PROBE_SEMAPHORE(document_end);
+LEQUEL_PROBE_SEMAPHORE(chunk_processed);
+LEQUEL_PROBE_SEMAPHORE(profile_built);
+LEQUEL_PROBE_SEMAPHORE(language_scored);
+LEQUEL_PROBE_SEMAPHORE(model_loaded);
+
+#endif
@@ -0,0 +1,104 @@
+/**
+ * @brief Lequel? USDT (statically defined) tracepoints
+ * @author Dylan Frigerio, Micaela Dinsen
+ *
+ * @copyright Copyright (c) 2022-2023
+ *
+ * When <sys/sdt.h> is available (systemtap-sdt-dev), every probe is a nop
+ * instruction plus an ELF note, so a running process can be traced without
+ * rebuilding or restarting it, for instance:
+ *
+ *   bpftrace -e 'usdt:./lequel-server:lequel:document_end
+ *                { @ns = hist(arg1); }'
+ *
+ * Provider "lequel" probes and their arguments:
+ *   document_start(characters, lines)
+ *   document_end(characters, duration_ns, language_code, similarity_ppm, cache_hit)
+ *   chunk_processed(bytes, processed_bytes, total_bytes, duration_ns)
+ *   profile_built(unique_trigrams, trigrams, duration_ns)
+ *   language_scored(language_index, language_code, similarity_ppm)
+ *   model_loaded(languages, memory_bytes, duration_ns)
+ *
+ * Each probe has a semaphore that the tracer raises while attached to it, so
+ * its arguments (and the clock reads of its duration, see LEQUEL_PROBE_TIME)
+ * are only computed while someone listens. Without the header, or with
+ * LEQUEL_NO_PROBES defined, probes compile to nothing, their arguments are
+ * not evaluated and LEQUEL_PROBE_TIME is 0.
+ */
+
+#ifndef PROBES_H
+#define PROBES_H
+
+#include <chrono>
+#include <cstdint>
+
+#if !defined(LEQUEL_NO_PROBES) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+#define LEQUEL_HAS_PROBES 1
+#endif
+#endif
+
+#ifdef LEQUEL_HAS_PROBES
+
+// Semaphores (defined in Probes.cpp): non-zero while a tracer is attached
+extern volatile unsigned short lequel_document_start_semaphore;
+extern volatile unsigned short lequel_document_end_semaphore;
+extern volatile unsigned short lequel_chunk_processed_semaphore;
+extern volatile unsigned short lequel_profile_built_semaphore;
+extern volatile unsigned short lequel_language_scored_semaphore;
+extern volatile unsigned short lequel_model_loaded_semaphore;
+
+#define LEQUEL_PROBE_ENABLED(name) __builtin_expect(lequel_##name##_semaphore != 0, 0)
+
+#define LEQUEL_PROBE2(name, a, b) \
+    do { if (LEQUEL_PROBE_ENABLED(name)) DTRACE_PROBE2(lequel, name, a, b); } while (0)
+#define LEQUEL_PROBE3(name, a, b, c) \
+    do { if (LEQUEL_PROBE_ENABLED(name)) DTRACE_PROBE3(lequel, name, a, b, c); } while (0)
+#define LEQUEL_PROBE4(name, a, b, c, d) \
+    do { if (LEQUEL_PROBE_ENABLED(name)) DTRACE_PROBE4(lequel, name, a, b, c, d); } while (0)
+#define LEQUEL_PROBE5(name, a, b, c, d, e) \
+    do { if (LEQUEL_PROBE_ENABLED(name)) DTRACE_PROBE5(lequel, name, a, b, c, d, e); } while (0)
+
+#else
+
+// sizeof() does not evaluate its operand, but still marks variables as used
+#define LEQUEL_PROBE_ENABLED(name) false
+#define LEQUEL_PROBE2(name, a, b) ((void)sizeof(a), (void)sizeof(b))
+#define LEQUEL_PROBE3(name, a, b, c) ((void)sizeof(a), (void)sizeof(b), (void)sizeof(c))
+#define LEQUEL_PROBE4(name, a, b, c, d) ((void)sizeof(a), (void)sizeof(b), (void)sizeof(c), (void)sizeof(d))
+#define LEQUEL_PROBE5(name, a, b, c, d, e) \
+    ((void)sizeof(a), (void)sizeof(b), (void)sizeof(c), (void)sizeof(d), (void)sizeof(e))
+
+#endif
+
+/**
+ * @brief Timestamp for probe durations, in ns.
+ */
+inline uint64_t getProbeTime()
+{
+    auto now = std::chrono::steady_clock::now().time_since_epoch();
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(now).count();
+}
+
+// Start time of a probe's duration: the clock is only read while a tracer is
+// attached to the probe (0 otherwise)
+#define LEQUEL_PROBE_TIME(name) (LEQUEL_PROBE_ENABLED(name) ? getProbeTime() : (uint64_t)0)
+
+/**
+ * @brief Duration since a LEQUEL_PROBE_TIME, in ns (0 if the tracer attached
+ *        after it).
+ */
+inline uint64_t getProbeDuration(uint64_t startTime)
+{
+    return startTime ? getProbeTime() - startTime : 0;
+}
+
+// Similarity in millionths, as probe arguments are integers
+inline int64_t getProbeSimilarity(float similarity)
+{
+    return (int64_t)(similarity * 1e6f);
+}
+
+#endif
@@ -0,0 +1,212 @@
+/**
+ * @brief Lequel? in-process LRU cache of identification results
+ * @author Dylan Frigerio, Micaela Dinsen
+ *
+ * @copyright Copyright (c) 2022-2023
+ *
+ * @cite https://github.com/aappleby/smhasher/blob/master/src/MurmurHash3.cpp
+ */
+
+#include <cstring>
+
+#include "ResultCache.h"
+#include "Metrics.h"
+
+using namespace std;
+
+namespace
+{
+    inline uint64_t rotateLeft(uint64_t x, int r)
+    {
+        return (x << r) | (x >> (64 - r));
+    }
+
+    inline uint64_t finalMix(uint64_t k)
+    {
+        k ^= k >> 33;
+        k *= 0xFF51AFD7ED558CCD;
+        k ^= k >> 33;
+        k *= 0xC4CEB9FE1A85EC53;
+        k ^= k >> 33;
+        return k;
+    }
+
+    /**
+     * @brief MurmurHash3 x64 128-bit, continuing from a previous hash.
+     */
+    TextHash hashBytes(const void *key, size_t size, TextHash hash)
+    {
+        const uint8_t *data = (const uint8_t *)key;
+        const size_t blockNum = size / 16;
+
+        const uint64_t c1 = 0x87C37B91114253D5;
+        const uint64_t c2 = 0x4CF5AD432745937F;
+
+        uint64_t h1 = hash.low;
+        uint64_t h2 = hash.high;
+
+        for (size_t i = 0; i < blockNum; i++)
+        {
+            uint64_t k1, k2;
+            memcpy(&k1, data + i * 16, 8);
+            memcpy(&k2, data + i * 16 + 8, 8);
+
+            k1 *= c1;
+            k1 = rotateLeft(k1, 31);
+            k1 *= c2;
+            h1 ^= k1;
+
+            h1 = rotateLeft(h1, 27);
+            h1 += h2;
+            h1 = h1 * 5 + 0x52DCE729;
+
+            k2 *= c2;
+            k2 = rotateLeft(k2, 33);
+            k2 *= c1;
+            h2 ^= k2;
+
+            h2 = rotateLeft(h2, 31);
+            h2 += h1;
+            h2 = h2 * 5 + 0x38495AB5;
+        }
+
+        // Tail: the last 0 to 15 bytes
+        const uint8_t *tail = data + blockNum * 16;
+        uint64_t k1 = 0;
+        uint64_t k2 = 0;
+
+        for (size_t i = size & 15; i > 8; i--)
+            k2 ^= (uint64_t)tail[i - 1] << ((i - 9) * 8);
+        if (size & 15)
+        {
+            k2 *= c2;
+            k2 = rotateLeft(k2, 33);
+            k2 *= c1;
+            h2 ^= k2;
+        }
+
+        for (size_t i = min(size & 15, (size_t)8); i > 0; i--)
+            k1 ^= (uint64_t)tail[i - 1] << ((i - 1) * 8);
+        if (size & 15)
+        {
+            k1 *= c1;
+            k1 = rotateLeft(k1, 31);
+            k1 *= c2;
+            h1 ^= k1;
+        }
+
+        h1 ^= size;
+        h2 ^= size;
+
+        h1 += h2;
+        h2 += h1;
+
+        h1 = finalMix(h1);
+        h2 = finalMix(h2);
+
+        h1 += h2;
+        h2 += h1;
+
+        return {h1, h2};
+    }
+}
+
+/**
+ * @brief Hashes a normalized text: its characters and where its lines start
+ *        (trigrams never span lines, so both decide the result).
+ *
+ * @param text The text
+ * @return TextHash 128-bit hash
+ */
+TextHash hashText(const Text &text)
+{
+    TextHash hash = hashBytes(text.characters.data(), text.characters.size() * sizeof(char16_t), {0, 0});
+    return hashBytes(text.lineOffsets.data(), text.lineOffsets.size() * sizeof(size_t), hash);
+}
+
+/**
+ * The capacity is split among the shards so that they add up to it exactly;
+ * a cache smaller than shardNum gets one shard per result.
+ *
+ * @param capacity Maximum number of results kept
+ * @param shardNum Number of independently locked shards
+ */
+ResultCache::ResultCache(size_t capacity, unsigned shardNum)
+    : capacity(capacity), shards(max(min((size_t)shardNum, capacity), (size_t)1))
+{
+    for (size_t i = 0; i < shards.size(); i++)
+        shards[i].capacity = capacity / shards.size() + (i < capacity % shards.size());
+}
+
+/**
+ * @brief Looks up a result and marks it as the most recently used.
+ *
+ * @param key Hash of the text
+ * @param guess Receives the cached result
+ * @return Whether the result was cached
+ */
+bool ResultCache::get(const TextHash &key, LanguageGuess &guess)
+{
+    Shard &shard = getShard(key);
+    {
+        lock_guard<mutex> guard(shard.lock);
+
+        auto it = shard.index.find(key);
+        if (it != shard.index.end())
+        {
+            shard.entries.splice(shard.entries.begin(), shard.entries, it->second);
+            guess = it->second->second;
+
+            hitCount.fetch_add(1, memory_order_relaxed);
+            addMetric(MetricCounter::CacheHits);
+            return true;
+        }
+    }
+
+    missCount.fetch_add(1, memory_order_relaxed);
+    addMetric(MetricCounter::CacheMisses);
+    return false;
+}
+
+/**
+ * @brief Stores a result, evicting the least recently used one of its shard
+ *        when the shard is full.
+ *
+ * @param key Hash of the text
+ * @param guess The result
+ */
+void ResultCache::put(const TextHash &key, const LanguageGuess &guess)
+{
+    if (!capacity)
+        return;
+
+    Shard &shard = getShard(key);
+    lock_guard<mutex> guard(shard.lock);
+
+    auto it = shard.index.find(key);
+    if (it != shard.index.end())
+    {
+        it->second->second = guess;
+        shard.entries.splice(shard.entries.begin(), shard.entries, it->second);
+        return;
+    }
+
+    if (shard.entries.size() >= shard.capacity)
+    {
+        shard.index.erase(shard.entries.back().first);
+        shard.entries.pop_back();
+    }
+
+    shard.entries.emplace_front(key, guess);
+    shard.index[key] = shard.entries.begin();
+}
+
+void ResultCache::clear()
+{
+    for (Shard &shard : shards)
+    {
+        lock_guard<mutex> guard(shard.lock);
+        shard.index.clear();
+        shard.entries.clear();
+    }
+}
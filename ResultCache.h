@@ -0,0 +1,80 @@
+/**
+ * @brief Lequel? in-process LRU cache of identification results
+ * @author Dylan Frigerio, Micaela Dinsen
+ *
+ * @copyright Copyright (c) 2022-2023
+ *
+ * Results are keyed by a 128-bit MurmurHash3 of the normalized Text (the
+ * lowercased characters and the line offsets), so a repeated input costs
+ * one pass over its characters. The cache is split in shards, each with its
+ * own lock and LRU list, so concurrent workers rarely wait on each other.
+ * A cache belongs to one model: results of another model (or of other
+ * IdentifyOptions) must not share it.
+ */
+
+#ifndef RESULTCACHE_H
+#define RESULTCACHE_H
+
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "Lequel.h"
+
+// TextHash: 128-bit hash of a normalized Text
+struct TextHash
+{
+    uint64_t low;
+    uint64_t high;
+
+    bool operator==(const TextHash &other) const { return low == other.low && high == other.high; }
+};
+
+TextHash hashText(const Text &text);
+
+class ResultCache
+{
+public:
+    explicit ResultCache(size_t capacity, unsigned shardNum = 16);
+
+    ResultCache(const ResultCache &) = delete;
+    ResultCache &operator=(const ResultCache &) = delete;
+
+    bool get(const TextHash &key, LanguageGuess &guess);
+    void put(const TextHash &key, const LanguageGuess &guess);
+    void clear();
+
+    size_t getCapacity() const { return capacity; }
+    uint64_t getHitCount() const { return hitCount.load(std::memory_order_relaxed); }
+    uint64_t getMissCount() const { return missCount.load(std::memory_order_relaxed); }
+
+private:
+    struct TextHashHasher
+    {
+        size_t operator()(const TextHash &hash) const { return (size_t)hash.high; }
+    };
+
+    typedef std::list<std::pair<TextHash, LanguageGuess>> Entries;
+
+    // Most recently used entries first
+    struct Shard
+    {
+        std::mutex lock;
+        size_t capacity = 0;
+        Entries entries;
+        std::unordered_map<TextHash, Entries::iterator, TextHashHasher> index;
+    };
+
+    Shard &getShard(const TextHash &key) { return shards[key.low % shards.size()]; }
+
+    size_t capacity;
+    std::vector<Shard> shards;
+    std::atomic<uint64_t> hitCount{0};
+    std::atomic<uint64_t> missCount{0};
+};
+
+#endif
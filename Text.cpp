@@ -2,86 +2,447 @@
  * @brief Reads text files
  * @author Marc S. Ressl
  * @modified Dylan Frigerio, Micaela Dinsen
- * 
+ *
  * @copyright Copyright (c) 2022-2023
  */
 
-#include <fstream>
-#include <codecvt>
-#include <locale>
 #include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
 #include <cwctype>
+#include <filesystem>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "Text.h"
+#include "Kernels.h"
+#include "MappedFile.h"
+#include "Metrics.h"
+#include "PerfCounters.h"
+#include "Trace.h"
 
 using namespace std;
 
+namespace {
+    const char16_t REPLACEMENT_CHARACTER = 0xFFFD;
+
+    /**
+     * @brief Decodes the UTF-8 sequence at data[i] and advances i past it.
+     *
+     * Invalid or truncated sequences (including overlong forms and encoded
+     * surrogates) decode as U+FFFD and consume a single byte.
+     */
+    inline char32_t decodeUtf8(const unsigned char* data, size_t size, size_t& i) {
+        const unsigned char lead = data[i];
+        char32_t c;
+        size_t length;
+        char32_t minimum;
+
+        if (lead < 0xC2) {
+            i++;
+            return REPLACEMENT_CHARACTER; // Continuation byte or overlong lead
+        }
+        else if (lead < 0xE0) {
+            c = lead & 0x1F;
+            length = 2;
+            minimum = 0x80;
+        }
+        else if (lead < 0xF0) {
+            c = lead & 0x0F;
+            length = 3;
+            minimum = 0x800;
+        }
+        else if (lead < 0xF5) {
+            c = lead & 0x07;
+            length = 4;
+            minimum = 0x10000;
+        }
+        else {
+            i++;
+            return REPLACEMENT_CHARACTER;
+        }
+
+        if (i + length > size) {
+            i++;
+            return REPLACEMENT_CHARACTER;
+        }
+        for (size_t j = 1; j < length; j++) {
+            const unsigned char continuation = data[i + j];
+            if ((continuation & 0xC0) != 0x80) {
+                i++;
+                return REPLACEMENT_CHARACTER;
+            }
+            c = (c << 6) | (continuation & 0x3F);
+        }
+        if (c < minimum || c > 0x10FFFF || (c >= 0xD800 && c <= 0xDFFF)) {
+            i++;
+            return REPLACEMENT_CHARACTER;
+        }
+
+        i += length;
+        return c;
+    }
+
+    /**
+     * @brief Reads a file descriptor to the end (or up to maxBytes).
+     */
+    bool readDescriptor(int fd, size_t maxBytes, string& data) {
+        const size_t BLOCK_SIZE = 1 << 16;
+
+        while (data.size() < maxBytes) {
+            const size_t position = data.size();
+            data.resize(position + min(BLOCK_SIZE, maxBytes - position));
+
+            const ssize_t size = read(fd, &data[position], data.size() - position);
+            if (size < 0 && errno == EINTR) {
+                data.resize(position);
+                continue;
+            }
+            if (size <= 0) {
+                data.resize(position);
+                return size == 0;
+            }
+            data.resize(position + (size_t)size);
+        }
+        return true;
+    }
+
+    /**
+     * @brief Shortens a truncated buffer so it does not end in the middle of
+     *        a UTF-8 sequence.
+     */
+    inline size_t trimIncompleteSequence(const char* data, size_t size) {
+        // Find the lead byte of the last sequence
+        size_t start = size;
+        while (start > 0 && (size - start) < 3 && ((unsigned char)data[start - 1] & 0xC0) == 0x80)
+            start--;
+        if (start == 0)
+            return size;
+
+        const unsigned char lead = (unsigned char)data[start - 1];
+        const size_t expectedLength = (lead >= 0xF0) ? 4 : (lead >= 0xE0) ? 3 : (lead >= 0xC0) ? 2 : 1;
+        return (size - (start - 1) < expectedLength) ? start - 1 : size;
+    }
+
+    /**
+     * @brief Reads exactly size bytes at offset (fewer only at end of file).
+     */
+    bool readAt(int fd, char* data, size_t size, off_t offset, size_t& readSize) {
+        readSize = 0;
+        while (readSize < size) {
+            const ssize_t result = pread(fd, data + readSize, size - readSize, offset + (off_t)readSize);
+            if (result < 0 && errno == EINTR)
+                continue;
+            if (result < 0)
+                return false;
+            if (result == 0)
+                break;
+            readSize += (size_t)result;
+        }
+        return true;
+    }
+}
+
 /**
- * @brief Converts a '\n'-separated string to a list of wstrings.
+ * @brief Converts a '\n'-separated string to a Text.
  *
  * @param s String to convert
  * @param text Destination text
  * @return Function succeeded
  */
 bool getTextFromString(const string& s, Text& text)
+{
+    return getTextFromBuffer(s.data(), s.size(), text);
+}
+
+/**
+ * @brief Converts a '\n'-separated UTF-8 buffer to a Text.
+ *
+ * Decoding, lowercasing and line splitting happen in one pass straight from
+ * the buffer (which may be a memory-mapped file) into the Text.
+ *
+ * @param data Start of the buffer
+ * @param size Size of the buffer in bytes
+ * @param text Destination text
+ * @return Function succeeded
+ */
+bool getTextFromBuffer(const char* data, size_t size, Text& text)
 {
     text.clear();
 
-    // Convertir el string completo a wstring
-    wstring_convert<codecvt_utf8_utf16<wchar_t>> converter;
-    wstring ws = converter.from_bytes(s);
-    transform(ws.begin(), ws.end(), ws.begin(), ::towlower);
+    addMetric(MetricCounter::BytesDecoded, size);
+    MetricTimer timer(MetricHistogram::DecodeLatency);
+    PerfScope perfScope(PerfStage::Decode);
+    // Decoding, lowercasing and line splitting are one pass, so one span
+    TRACE_SCOPE("decode");
+
+    // A UTF-8 byte never yields more than one UTF-16 unit
+    text.characters.resize(size);
+    char16_t* characters = text.characters.data();
+    size_t length = 0;
 
-    wstring::size_type position = 0;
-    wstring::size_type prevPosition = 0;
-    while ((position = ws.find(L'\n', prevPosition)) != wstring::npos)
+    const unsigned char* bytes = (const unsigned char*)data;
+    const Kernels& kernels = getKernels();
+    size_t i = 0;
+
+    text.lineOffsets.push_back(0);
+    while (i < size)
     {
-        if ((position > prevPosition) && (ws[position - 1] == L'\r'))
-            text.push_back(ws.substr(prevPosition, position - 1 - prevPosition));
-        else
-            text.push_back(ws.substr(prevPosition, position - prevPosition));
+        const unsigned char byte = bytes[i];
 
-        prevPosition = position + 1;
+        if (byte == '\n')
+        {
+            i++;
+            if ((length > text.lineOffsets.back()) && (characters[length - 1] == u'\r'))
+                length--;
+            text.lineOffsets.push_back(length);
+            continue;
+        }
+        if (byte < 0x80)
+        {
+            // ASCII run, up to the next '\n' or non-ASCII byte. The output
+            // is never ahead of the input, so it has room for the whole run.
+            const size_t runSize = kernels.decodeAscii(bytes + i, size - i, characters + length);
+            i += runSize;
+            length += runSize;
+            continue;
+        }
+
+        const char32_t c = (char32_t)towlower(decodeUtf8(bytes, size, i));
+        if (c < 0x10000)
+            characters[length++] = (char16_t)c;
+        else
+        {
+            // Surrogate pair; a 4-byte sequence always leaves room for it
+            characters[length++] = (char16_t)(0xD800 + ((c - 0x10000) >> 10));
+            characters[length++] = (char16_t)(0xDC00 + ((c - 0x10000) & 0x3FF));
+        }
     }
 
-    // To get the last substring (or only, if delimiter is not found)
-    text.push_back(ws.substr(prevPosition));
+    // To close the last line (or only, if delimiter is not found)
+    text.lineOffsets.push_back(length);
+    text.characters.resize(length);
 
     return true;
 }
 
 /**
- * @brief Loads a text file as a list of wstrings.
+ * @brief Loads a text file as a Text.
+ *
+ * Regular files are memory-mapped and decoded in place; pipes and other
+ * special files are read through a buffer.
+ *
+ * @param path Path of file to read
+ * @param text Destination text
+ * @param maxBytes Read at most this many bytes of the file
+ * @return Function succeeded
+ */
+bool getTextFromFile(const string path, Text& text, size_t maxBytes)
+{
+    TRACE_SCOPE("read file", path);
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0)
+    {
+        perror(("Error while opening file " + path).c_str());
+        return false;
+    }
+
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) < 0)
+    {
+        perror(("Error while reading file: " + path).c_str());
+        close(fd);
+        return false;
+    }
+
+    bool success;
+    if (S_ISREG(fileStat.st_mode))
+    {
+        // Map only the bytes that will be decoded, so a cap on a huge file
+        // neither reserves nor reads ahead the rest (the trim only looks
+        // back from the cut)
+        const size_t fileSize = (size_t)fileStat.st_size;
+        MappedFile file;
+        success = file.map(fd, min(fileSize, maxBytes));
+        if (success)
+        {
+            file.adviseSequential();
+
+            size_t size = file.getSize();
+            if (fileSize > maxBytes)
+                size = trimIncompleteSequence(file.getData(), size);
+            success = getTextFromBuffer(file.getData(), size, text);
+        }
+    }
+    else
+        success = getTextFromDescriptor(fd, text, maxBytes);
+
+    if (!success)
+        perror(("Error while reading file: " + path).c_str());
+
+    close(fd);
+    return success;
+}
+
+/**
+ * @brief Reads a Text from a pipe or any other file descriptor.
+ *
+ * @param fd The descriptor (not closed)
+ * @param text Destination text
+ * @param maxBytes Read at most this many bytes
+ * @return Function succeeded
+ */
+bool getTextFromDescriptor(int fd, Text& text, size_t maxBytes)
+{
+    TRACE_SCOPE("read stream");
+    string data;
+    if (!readDescriptor(fd, maxBytes, data))
+        return false;
+
+    size_t size = data.size();
+    if (size == maxBytes)
+        size = trimIncompleteSequence(data.data(), size);
+    return getTextFromBuffer(data.data(), size, text);
+}
+
+/**
+ * @brief Loads evenly spaced windows of a large text file as a Text.
+ *
+ * Files no larger than windowNum * windowSize (and pipes) are read whole,
+ * up to maxBytes. Larger files are sampled with pread(): the windows cover the start and
+ * the end of the file, skip a partial UTF-8 sequence at their start and
+ * drop one at their end, and are stored as separate lines so no trigram
+ * spans two windows.
  *
  * @param path Path of file to read
  * @param text Destination text
+ * @param windowNum Number of windows (K)
+ * @param windowSize Size of each window in bytes (W)
+ * @param sampledFraction If not null, receives the fraction of the file read
+ * @param maxBytes Read at most this many bytes of a file read whole
  * @return Function succeeded
  */
-bool getTextFromFile(const string path, Text& text)
+bool getSampledTextFromFile(const string path, Text& text, size_t windowNum, size_t windowSize,
+                            double* sampledFraction, size_t maxBytes)
 {
-    ifstream file(path, ios::binary);
+    TRACE_SCOPE("read samples", path);
+    if (sampledFraction)
+        *sampledFraction = 1.0;
+
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
 
-    if (!file.is_open())
+    if (fd < 0)
     {
         perror(("Error while opening file " + path).c_str());
         return false;
     }
 
-    // Get file size
-    file.seekg(0, ios::end);
-    int fileSize = file.tellg() > 10000000 ? 10000000 : (int)file.tellg();
-    string fileData(fileSize, ' ');
-    file.seekg(0);
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) < 0)
+    {
+        perror(("Error while reading file: " + path).c_str());
+        close(fd);
+        return false;
+    }
 
-    file.read(&fileData[0], fileSize);
+    // A pipe can only be read once: read it through the open descriptor
+    if (!S_ISREG(fileStat.st_mode))
+    {
+        bool success = getTextFromDescriptor(fd, text, maxBytes);
+        if (!success)
+            perror(("Error while reading file: " + path).c_str());
 
-    if (file.fail())
+        close(fd);
+        return success;
+    }
+
+    const size_t fileSize = (size_t)fileStat.st_size;
+    if (windowNum == 0 || windowSize == 0 || fileSize / windowNum <= windowSize)
+    {
+        close(fd);
+        if (sampledFraction && fileSize > maxBytes)
+            *sampledFraction = (double)maxBytes / (double)fileSize;
+        return getTextFromFile(path, text, maxBytes);
+    }
+
+    string data;
+    data.reserve(windowNum * (windowSize + 1));
+
+    bool success = true;
+    size_t sampledSize = 0;
+    for (size_t window = 0; window < windowNum && success; window++)
+    {
+        const size_t offset = (windowNum > 1) ? (fileSize - windowSize) / (windowNum - 1) * window : 0;
+
+        const size_t position = data.size();
+        data.resize(position + windowSize);
+
+        size_t readSize;
+        success = readAt(fd, &data[position], windowSize, (off_t)offset, readSize);
+        sampledSize += readSize;
+
+        // Align the window to whole UTF-8 sequences
+        const char* windowData = data.data() + position;
+        size_t start = 0;
+        while (start < readSize && start < 3 && ((unsigned char)windowData[start] & 0xC0) == 0x80)
+            start++;
+        const size_t end = trimIncompleteSequence(windowData, readSize);
+
+        if (start < end)
+        {
+            data.resize(position + end);
+            data.erase(position, start);
+        }
+        else
+            data.resize(position);
+        data.push_back('\n');
+    }
+    close(fd);
+
+    if (!success)
     {
         perror(("Error while reading file: " + path).c_str());
         return false;
     }
 
-    file.close();
+    if (sampledFraction)
+        *sampledFraction = (double)sampledSize / (double)fileSize;
+    return getTextFromBuffer(data.data(), data.size(), text);
+}
+
+/**
+ * @brief Adds a path to a list of documents; directories add every regular
+ *        file below them, in name order.
+ *
+ * @param path A file or directory
+ * @param paths Receives the paths
+ */
+void addTextFilePaths(const string &path, vector<string> &paths)
+{
+    error_code error;
+    if (!filesystem::is_directory(path, error))
+    {
+        paths.push_back(path);
+        return;
+    }
+
+    vector<string> directoryPaths;
+    auto options = filesystem::directory_options::skip_permission_denied;
+    for (auto it = filesystem::recursive_directory_iterator(path, options, error);
+         it != filesystem::recursive_directory_iterator(); it.increment(error))
+    {
+        if (error)
+            break;
+        if (it->is_regular_file(error))
+            directoryPaths.push_back(it->path().string());
+    }
+    if (error)
+        fprintf(stderr, "Error while scanning %s: %s\n", path.c_str(), error.message().c_str());
 
-    return getTextFromString(fileData, text);
-}
\ No newline at end of file
+    sort(directoryPaths.begin(), directoryPaths.end());
+    paths.insert(paths.end(), directoryPaths.begin(), directoryPaths.end());
+}
@@ -2,7 +2,7 @@
  * @brief Reads text files
  * @author Marc S. Ressl
  * @modified Dylan Frigerio, Micaela Dinsen
- * 
+ *
  * @copyright Copyright (c) 2022-2023
  */
 
@@ -11,12 +11,74 @@
 
 #include <vector>
 #include <string>
+#include <string_view>
+#include <memory_resource>
 
-// Text: list of strings
-typedef std::vector<std::wstring> Text;
+/**
+ * @brief Text: lowercased UTF-16 lines stored back to back in one buffer.
+ *
+ * Line i spans characters [lineOffsets[i], lineOffsets[i + 1]); line
+ * terminators are not stored. Construct it with a Workspace resource to
+ * place it in that arena.
+ */
+struct Text
+{
+    Text() = default;
+    explicit Text(std::pmr::memory_resource *resource)
+        : characters(resource), lineOffsets(resource) {}
+
+    size_t getLineCount() const { return lineOffsets.empty() ? 0 : lineOffsets.size() - 1; }
+
+    std::u16string_view getLine(size_t i) const
+    {
+        return std::u16string_view(characters.data() + lineOffsets[i],
+                                   lineOffsets[i + 1] - lineOffsets[i]);
+    }
+
+    bool empty() const { return getLineCount() == 0; }
+
+    void clear()
+    {
+        characters.clear();
+        lineOffsets.clear();
+    }
+
+    // Iterates the lines as string views
+    class LineIterator
+    {
+    public:
+        LineIterator(const Text &text, size_t line) : text(text), line(line) {}
+
+        std::u16string_view operator*() const { return text.getLine(line); }
+        LineIterator &operator++()
+        {
+            line++;
+            return *this;
+        }
+        bool operator!=(const LineIterator &other) const { return line != other.line; }
+
+    private:
+        const Text &text;
+        size_t line;
+    };
+
+    LineIterator begin() const { return LineIterator(*this, 0); }
+    LineIterator end() const { return LineIterator(*this, getLineCount()); }
+
+    std::pmr::u16string characters;
+    std::pmr::vector<size_t> lineOffsets;
+};
+
+// Files larger than this are truncated, unless the caller asks otherwise
+const size_t TEXT_MAX_FILE_SIZE = 10000000;
 
 // Functions
 bool getTextFromString(const std::string &s, Text &text);
-bool getTextFromFile(const std::string path, Text &text);
+bool getTextFromBuffer(const char *data, size_t size, Text &text);
+bool getTextFromFile(const std::string path, Text &text, size_t maxBytes = TEXT_MAX_FILE_SIZE);
+bool getTextFromDescriptor(int fd, Text &text, size_t maxBytes = TEXT_MAX_FILE_SIZE);
+bool getSampledTextFromFile(const std::string path, Text &text, size_t windowNum, size_t windowSize,
+                            double *sampledFraction = nullptr, size_t maxBytes = TEXT_MAX_FILE_SIZE);
+void addTextFilePaths(const std::string &path, std::vector<std::string> &paths);
 
 #endif
@@ -0,0 +1,112 @@
+/**
+ * @brief Lequel? fixed-size worker thread pool
+ * @author Dylan Frigerio, Micaela Dinsen
+ *
+ * @copyright Copyright (c) 2022-2023
+ */
+
+#include <algorithm>
+#include <atomic>
+
+#include "ThreadPool.h"
+
+using namespace std;
+
+namespace {
+    thread_local int currentWorker = -1;
+}
+
+/**
+ * @brief Starts the worker threads.
+ * @param threadCount Number of workers (0: one per hardware thread)
+ */
+ThreadPool::ThreadPool(unsigned threadCount)
+{
+    if (!threadCount)
+        threadCount = max(thread::hardware_concurrency(), 1u);
+
+    for (unsigned i = 0; i < threadCount; i++)
+        threads.emplace_back(&ThreadPool::workerLoop, this, i);
+}
+
+/**
+ * @brief Finishes the queued tasks and joins the workers.
+ */
+ThreadPool::~ThreadPool()
+{
+    {
+        lock_guard<mutex> guard(lock);
+        stopping = true;
+    }
+    taskAvailable.notify_all();
+
+    for (auto &t : threads)
+        t.join();
+}
+
+/**
+ * @brief Queues a task for any worker.
+ */
+void ThreadPool::submit(function<void()> task)
+{
+    {
+        lock_guard<mutex> guard(lock);
+        tasks.push_back(move(task));
+    }
+    taskAvailable.notify_one();
+}
+
+void ThreadPool::parallelFor(size_t count, const function<void(size_t index, unsigned worker)> &body)
+{
+    if (!count)
+        return;
+
+    atomic<size_t> nextIndex{0};
+    size_t runnerNum = min(count, threads.size());
+    size_t finishedRunners = 0;
+    mutex doneLock;
+    condition_variable done;
+
+    // Each runner claims indices until none are left
+    for (size_t i = 0; i < runnerNum; i++)
+    {
+        submit([&]() {
+            size_t index;
+            while ((index = nextIndex.fetch_add(1, memory_order_relaxed)) < count)
+                body(index, (unsigned)currentWorker);
+
+            lock_guard<mutex> guard(doneLock);
+            if (++finishedRunners == runnerNum)
+                done.notify_one();
+        });
+    }
+
+    unique_lock<mutex> guard(doneLock);
+    done.wait(guard, [&]() { return finishedRunners == runnerNum; });
+}
+
+int ThreadPool::getCurrentWorker()
+{
+    return currentWorker;
+}
+
+void ThreadPool::workerLoop(unsigned worker)
+{
+    currentWorker = (int)worker;
+
+    while (true)
+    {
+        function<void()> task;
+        {
+            unique_lock<mutex> guard(lock);
+            taskAvailable.wait(guard, [this]() { return stopping || !tasks.empty(); });
+
+            if (tasks.empty())
+                return;
+
+            task = move(tasks.front());
+            tasks.pop_front();
+        }
+        task();
+    }
+}
@@ -0,0 +1,52 @@
+/**
+ * @brief Lequel? fixed-size worker thread pool
+ * @author Dylan Frigerio, Micaela Dinsen
+ *
+ * @copyright Copyright (c) 2022-2023
+ */
+
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool
+{
+public:
+    explicit ThreadPool(unsigned threadCount = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    unsigned getThreadCount() const { return (unsigned)threads.size(); }
+
+    void submit(std::function<void()> task);
+
+    /**
+     * @brief Runs body(index, worker) for every index in [0, count) and waits.
+     *
+     * worker is in [0, getThreadCount()), so callers can keep one slot of
+     * thread-local state per worker. Must not be called from a pool thread.
+     */
+    void parallelFor(size_t count, const std::function<void(size_t index, unsigned worker)> &body);
+
+    // Index of the calling pool thread, or -1 when called from another thread
+    static int getCurrentWorker();
+
+private:
+    void workerLoop(unsigned worker);
+
+    std::vector<std::thread> threads;
+    std::deque<std::function<void()>> tasks;
+    std::mutex lock;
+    std::condition_variable taskAvailable;
+    bool stopping = false;
+};
+
+#endif
@@ -0,0 +1,250 @@
+/**
+ * @brief Lequel? timeline tracing (Chrome trace-event format)
+ * @author Dylan Frigerio, Micaela Dinsen
+ *
+ * @copyright Copyright (c) 2022-2023
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "Trace.h"
+#include "ThreadPool.h"
+
+using namespace std;
+
+atomic<bool> traceEnabled{false};
+
+namespace
+{
+    struct TraceEvent
+    {
+        const char *name;
+        uint64_t startTime; // ns since startTrace()
+        uint64_t duration;  // ns
+        char detail[TRACE_DETAIL_SIZE];
+    };
+
+    // Ring buffer of one thread: only that thread writes it
+    struct TraceBuffer
+    {
+        vector<TraceEvent> events;
+        atomic<uint64_t> eventCount{0}; // Spans ever written; the slot is count % size
+        int threadId;
+        string threadName;
+    };
+
+    // Buffers outlive their threads, so a trace also shows finished threads
+    struct TraceRegistry
+    {
+        mutex lock;
+        vector<unique_ptr<TraceBuffer>> buffers;
+        size_t capacity = TRACE_DEFAULT_CAPACITY;
+        chrono::steady_clock::time_point epoch;
+    };
+
+    TraceRegistry &getRegistry()
+    {
+        static TraceRegistry registry;
+        return registry;
+    }
+
+    thread_local TraceBuffer *threadBuffer = nullptr;
+
+    TraceBuffer &getThreadBuffer()
+    {
+        if (threadBuffer)
+            return *threadBuffer;
+
+        TraceRegistry &registry = getRegistry();
+        lock_guard<mutex> guard(registry.lock);
+
+        auto buffer = make_unique<TraceBuffer>();
+        buffer->events.resize(registry.capacity);
+        buffer->threadId = (int)registry.buffers.size() + 1;
+
+        int worker = ThreadPool::getCurrentWorker();
+        buffer->threadName = (worker >= 0) ? "worker " + to_string(worker)
+                                           : "thread " + to_string(buffer->threadId);
+
+        threadBuffer = buffer.get();
+        registry.buffers.push_back(move(buffer));
+        return *threadBuffer;
+    }
+
+    inline uint64_t getTraceTime()
+    {
+        auto elapsed = chrono::steady_clock::now() - getRegistry().epoch;
+        return (uint64_t)chrono::duration_cast<chrono::nanoseconds>(elapsed).count();
+    }
+
+    /**
+     * @brief Appends a string to JSON output, escaped.
+     */
+    void appendJSONString(string &json, const char *s)
+    {
+        json += '"';
+        for (; *s; s++)
+        {
+            const unsigned char c = (unsigned char)*s;
+            if (c == '"' || c == '\\')
+            {
+                json += '\\';
+                json += (char)c;
+            }
+            else if (c < 0x20)
+            {
+                char escaped[8];
+                snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                json += escaped;
+            }
+            else
+                json += (char)c;
+        }
+        json += '"';
+    }
+}
+
+/**
+ * @brief Starts recording spans, discarding those of an earlier trace.
+ *
+ * @param capacity Spans kept per thread (the most recent ones)
+ */
+void startTrace(size_t capacity)
+{
+    TraceRegistry &registry = getRegistry();
+    {
+        lock_guard<mutex> guard(registry.lock);
+
+        registry.capacity = max(capacity, (size_t)1);
+        for (auto &buffer : registry.buffers)
+        {
+            buffer->events.assign(registry.capacity, TraceEvent());
+            buffer->eventCount.store(0, memory_order_relaxed);
+        }
+        registry.epoch = chrono::steady_clock::now();
+    }
+    traceEnabled.store(true, memory_order_release);
+}
+
+/**
+ * @brief Stops recording spans (the recorded ones are kept).
+ */
+void stopTrace()
+{
+    traceEnabled.store(false, memory_order_release);
+}
+
+void TraceScope::begin(const char *name, const char *detail)
+{
+    this->name = name;
+    this->detail[0] = '\0';
+
+    if (detail)
+    {
+        // Keep the end of long details (the file name of a path), starting
+        // at a code point boundary so the JSON stays valid UTF-8
+        size_t size = strlen(detail);
+        if (size >= TRACE_DETAIL_SIZE)
+        {
+            detail += size - (TRACE_DETAIL_SIZE - 1);
+            while (((unsigned char)*detail & 0xC0) == 0x80)
+                detail++;
+            size = strlen(detail);
+        }
+        memcpy(this->detail, detail, size + 1);
+    }
+
+    startTime = getTraceTime();
+}
+
+void TraceScope::end()
+{
+    const uint64_t endTime = getTraceTime();
+
+    TraceBuffer &buffer = getThreadBuffer();
+    const uint64_t index = buffer.eventCount.load(memory_order_relaxed);
+    TraceEvent &event = buffer.events[index % buffer.events.size()];
+
+    event.name = name;
+    event.startTime = startTime;
+    event.duration = endTime - startTime;
+    memcpy(event.detail, detail, sizeof(detail));
+
+    buffer.eventCount.store(index + 1, memory_order_release);
+}
+
+/**
+ * @brief Writes the recorded spans as Chrome trace-event JSON: one complete
+ *        ("X") event per span and one thread name per thread.
+ *
+ * @param path The output file
+ * @return Function succeeded
+ */
+bool writeTraceJSON(const string &path)
+{
+    string json = "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+    bool isFirstEvent = true;
+    char number[64];
+
+    {
+        TraceRegistry &registry = getRegistry();
+        lock_guard<mutex> guard(registry.lock);
+
+        for (const auto &buffer : registry.buffers)
+        {
+            const uint64_t eventCount = buffer->eventCount.load(memory_order_acquire);
+            const uint64_t capacity = buffer->events.size();
+            const uint64_t firstEvent = (eventCount > capacity) ? eventCount - capacity : 0;
+            if (!eventCount)
+                continue;
+
+            if (firstEvent)
+                fprintf(stderr, "Trace: %s dropped its %llu oldest spans\n",
+                        buffer->threadName.c_str(), (unsigned long long)firstEvent);
+
+            if (!isFirstEvent)
+                json += ',';
+            isFirstEvent = false;
+            json += "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" +
+                    to_string(buffer->threadId) + ",\"args\":{\"name\":";
+            appendJSONString(json, buffer->threadName.c_str());
+            json += "}}";
+
+            for (uint64_t i = firstEvent; i < eventCount; i++)
+            {
+                const TraceEvent &event = buffer->events[i % capacity];
+
+                // Trace-event times are in microseconds
+                json += ",{\"name\":";
+                appendJSONString(json, event.name);
+                snprintf(number, sizeof(number), ",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f",
+                         event.startTime / 1000.0, event.duration / 1000.0);
+                json += number;
+                json += ",\"pid\":1,\"tid\":" + to_string(buffer->threadId);
+                if (event.detail[0])
+                {
+                    json += ",\"args\":{\"detail\":";
+                    appendJSONString(json, event.detail);
+                    json += '}';
+                }
+                json += '}';
+            }
+        }
+    }
+    json += "]}\n";
+
+    ofstream file(path, ios::binary | ios::trunc);
+    if (!file.is_open() || !file.write(json.data(), json.size()))
+    {
+        perror(("Error while writing trace " + path).c_str());
+        return false;
+    }
+    return true;
+}
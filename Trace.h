@@ -0,0 +1,90 @@
+/**
+ * @brief Lequel? timeline tracing (Chrome trace-event format)
+ * @author Dylan Frigerio, Micaela Dinsen
+ *
+ * @copyright Copyright (c) 2022-2023
+ *
+ * While tracing is on, TRACE_SCOPE records the start and duration of its
+ * scope into a ring buffer owned by the calling thread: a single writer per
+ * buffer, so recording takes no lock. When a buffer is full, the oldest
+ * spans are overwritten. writeTraceJSON() writes every buffer as a trace
+ * that chrome://tracing and https://ui.perfetto.dev open, one track per
+ * thread. While tracing is off, a span costs one relaxed atomic load.
+ *
+ * @cite https://docs.google.com/document/d/1CvAClvFfyA5R-PhYUmn5OOQtYMH4h6I0nSsKchNAySU
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Spans kept per thread (the most recent ones)
+const size_t TRACE_DEFAULT_CAPACITY = 1 << 16;
+
+// Size of the detail stored with a span; longer ones keep their end
+const size_t TRACE_DETAIL_SIZE = 32;
+
+extern std::atomic<bool> traceEnabled;
+
+// Functions
+void startTrace(size_t capacity = TRACE_DEFAULT_CAPACITY);
+void stopTrace();
+bool writeTraceJSON(const std::string &path);
+
+inline bool isTracing()
+{
+    return traceEnabled.load(std::memory_order_relaxed);
+}
+
+/**
+ * @brief Records the lifetime of a scope as a span of the calling thread.
+ *
+ * name must be a string literal (it is stored as a pointer); detail, such
+ * as a language code or a file name, is copied. Start tracing before the
+ * work to trace, and write the trace once it is done.
+ */
+class TraceScope
+{
+public:
+    explicit TraceScope(const char *name, const char *detail = nullptr)
+    {
+        if (isTracing())
+            begin(name, detail);
+    }
+
+    TraceScope(const char *name, const std::string &detail)
+    {
+        if (isTracing())
+            begin(name, detail.c_str());
+    }
+
+    ~TraceScope()
+    {
+        if (name)
+            end();
+    }
+
+    TraceScope(const TraceScope &) = delete;
+    TraceScope &operator=(const TraceScope &) = delete;
+
+private:
+    void begin(const char *name, const char *detail);
+    void end();
+
+    const char *name = nullptr;
+    uint64_t startTime;
+    char detail[TRACE_DETAIL_SIZE];
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+
+// Records the rest of the enclosing scope: TRACE_SCOPE("decode") or
+// TRACE_SCOPE("score", languageCode)
+#define TRACE_SCOPE(...) TraceScope TRACE_CONCAT(traceScope, __LINE__)(__VA_ARGS__)
+
+#endif
@@ -0,0 +1,185 @@
+/**
+ * @brief Lequel? vocabulary of the trigrams of all language profiles
+ * @author Dylan Frigerio, Micaela Dinsen
+ *
+ * @copyright Copyright (c) 2022-2023
+ */
+
+#include <algorithm>
+#include <mutex>
+
+#include "TrigramVocabulary.h"
+
+using namespace std;
+
+namespace
+{
+    const size_t VOCABULARY_MIN_SLOTS = 1 << 12;
+
+    // Text profiles with at least 1/16 of the vocabulary are put in id order
+    // by scattering, not sorting
+    const size_t VOCABULARY_SCATTER_RATIO = 16;
+
+    void sortById(TrigramIdProfile &idProfile)
+    {
+        sort(idProfile.begin(), idProfile.end(),
+             [](const TrigramIdWeight &a, const TrigramIdWeight &b) { return a.id < b.id; });
+    }
+}
+
+/**
+ * @brief Finds the slot of a trigram: the one holding its id, or the empty
+ *        slot where it would go. Needs the lock and at least one empty slot.
+ */
+size_t TrigramVocabulary::findSlot(uint64_t trigram) const
+{
+    const size_t mask = slots.size() - 1;
+    size_t slot = (size_t)((trigram * 0x9E3779B97F4A7C15) >> 32) & mask;
+
+    while (slots[slot] && trigrams[slots[slot] - 1] != trigram)
+        slot = (slot + 1) & mask;
+    return slot;
+}
+
+/**
+ * @brief Doubles the table (kept at most half full) and reinserts every id.
+ */
+void TrigramVocabulary::grow()
+{
+    slots.assign(max(slots.size() * 2, VOCABULARY_MIN_SLOTS), 0);
+    for (size_t id = 0; id < trigrams.size(); id++)
+        slots[findSlot(trigrams[id])] = (TrigramId)(id + 1);
+}
+
+/**
+ * @brief Converts a language profile to ids, adding the trigrams that are
+ *        not in the vocabulary yet.
+ * @param profile The profile (normalized frequencies by trigram)
+ * @param idProfile Destination: the same weights by id, sorted by id
+ */
+void TrigramVocabulary::intern(const TrigramProfile &profile, TrigramIdProfile &idProfile)
+{
+    idProfile.clear();
+    idProfile.reserve(profile.size());
+    {
+        unique_lock<shared_mutex> guard(lock);
+        for (const auto &[trigram, weight] : profile)
+        {
+            if (2 * (trigrams.size() + 1) > slots.size())
+                grow();
+
+            const size_t slot = findSlot(trigram);
+            if (!slots[slot])
+            {
+                trigrams.push_back(trigram);
+                slots[slot] = (TrigramId)trigrams.size();
+            }
+            idProfile.push_back({slots[slot] - 1, weight});
+        }
+    }
+    sortById(idProfile);
+}
+
+template <typename Profile>
+void TrigramVocabulary::lookupProfile(const Profile &profile, TrigramIdProfile &idProfile) const
+{
+    idProfile.clear();
+    size_t vocabularySize;
+    {
+        shared_lock<shared_mutex> guard(lock);
+        if (slots.empty())
+            return;
+
+        vocabularySize = trigrams.size();
+        for (const auto &[trigram, weight] : profile)
+        {
+            if (const TrigramId id = slots[findSlot(trigram)])
+                idProfile.push_back({id - 1, weight});
+        }
+    }
+
+    // A large profile covers much of the vocabulary: scattering its weights
+    // by id and reading them back in order beats a comparison sort
+    if (idProfile.size() < vocabularySize / VOCABULARY_SCATTER_RATIO)
+    {
+        sortById(idProfile);
+        return;
+    }
+
+    // Per thread and all zeros between calls (reading a weight back clears
+    // it), so a document neither allocates nor clears the whole array
+    thread_local vector<float> weights;
+    if (weights.size() < vocabularySize)
+        weights.resize(vocabularySize);
+
+    for (const TrigramIdWeight &entry : idProfile)
+        weights[entry.id] = entry.weight;
+
+    idProfile.clear();
+    for (size_t id = 0; id < vocabularySize; id++)
+    {
+        if (weights[id] != 0.0f)
+        {
+            idProfile.push_back({(TrigramId)id, weights[id]});
+            weights[id] = 0.0f;
+        }
+    }
+}
+
+/**
+ * @brief Converts a text profile to ids. Trigrams that are in no language
+ *        profile are left out, as they never add to a dot product.
+ * @param profile The profile
+ * @param idProfile Destination: the weights of known trigrams by id, sorted by id
+ */
+void TrigramVocabulary::lookup(const TrigramProfile &profile, TrigramIdProfile &idProfile) const
+{
+    lookupProfile(profile, idProfile);
+}
+
+void TrigramVocabulary::lookup(const SortedTrigramProfile &profile, TrigramIdProfile &idProfile) const
+{
+    lookupProfile(profile, idProfile);
+}
+
+/**
+ * @brief Returns the trigram of an id.
+ */
+uint64_t TrigramVocabulary::getTrigram(TrigramId id) const
+{
+    shared_lock<shared_mutex> guard(lock);
+    return trigrams[id];
+}
+
+size_t TrigramVocabulary::size() const
+{
+    shared_lock<shared_mutex> guard(lock);
+    return trigrams.size();
+}
+
+/**
+ * @brief Estimates the heap memory used by the vocabulary, in bytes.
+ */
+size_t TrigramVocabulary::getMemoryUsage() const
+{
+    shared_lock<shared_mutex> guard(lock);
+    return trigrams.capacity() * sizeof(uint64_t) + slots.capacity() * sizeof(TrigramId);
+}
+
+/**
+ * @brief Estimates the memory taken by one trigram, in bytes: its entry in
+ *        the trigram array and its slots in the table (at most half full).
+ */
+size_t TrigramVocabulary::getEntrySize()
+{
+    return sizeof(uint64_t) + 2 * sizeof(TrigramId);
+}
+
+/**
+ * @brief Returns the vocabulary shared by every loaded language profile.
+ */
+TrigramVocabulary &getTrigramVocabulary()
+{
+    static TrigramVocabulary vocabulary;
+    return vocabulary;
+}
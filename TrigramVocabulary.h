@@ -0,0 +1,62 @@
+/**
+ * @brief Lequel? vocabulary of the trigrams of all language profiles
+ * @author Dylan Frigerio, Micaela Dinsen
+ *
+ * @copyright Copyright (c) 2022-2023
+ *
+ * Many trigrams (" de", "de ", "the") occur in dozens of languages. The
+ * vocabulary interns each of them once, as a dense 32-bit id, so language
+ * profiles are small (id, weight) arrays and a text profile is mapped to
+ * ids once per document, not once per language. Ids are handed out in the
+ * order trigrams are first seen and are never reused, so profiles of
+ * models loaded at different times (a LazyModel, or one model per size in
+ * lequel-bench) can share a single vocabulary.
+ *
+ * Lookups go through an open-addressing table of 32-bit ids, kept at most
+ * half full, that compares against the id-indexed trigram array. Safe to
+ * use from several threads: interning takes an exclusive lock, lookups a
+ * shared one.
+ */
+
+#ifndef TRIGRAMVOCABULARY_H
+#define TRIGRAMVOCABULARY_H
+
+#include <cstdint>
+#include <shared_mutex>
+#include <vector>
+
+#include "Lequel.h"
+
+class TrigramVocabulary
+{
+public:
+    TrigramVocabulary() = default;
+
+    TrigramVocabulary(const TrigramVocabulary &) = delete;
+    TrigramVocabulary &operator=(const TrigramVocabulary &) = delete;
+
+    void intern(const TrigramProfile &profile, TrigramIdProfile &idProfile);
+    void lookup(const TrigramProfile &profile, TrigramIdProfile &idProfile) const;
+    void lookup(const SortedTrigramProfile &profile, TrigramIdProfile &idProfile) const;
+    uint64_t getTrigram(TrigramId id) const;
+
+    size_t size() const;
+    size_t getMemoryUsage() const;
+
+    static size_t getEntrySize();
+
+private:
+    template <typename Profile>
+    void lookupProfile(const Profile &profile, TrigramIdProfile &idProfile) const;
+
+    size_t findSlot(uint64_t trigram) const;
+    void grow();
+
+    mutable std::shared_mutex lock;
+    std::vector<uint64_t> trigrams; // Trigram of each id
+    std::vector<TrigramId> slots;   // Open addressing: id + 1, or 0 if empty
+};
+
+TrigramVocabulary &getTrigramVocabulary();
+
+#endif
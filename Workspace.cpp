@@ -0,0 +1,70 @@
+/**
+ * @brief Lequel? per-thread scratch memory for transient engine structures
+ * @author Dylan Frigerio, Micaela Dinsen
+ *
+ * @copyright Copyright (c) 2022-2023
+ */
+
+#include "Workspace.h"
+
+using namespace std;
+
+// The arena never keeps more than this between documents, so a single huge
+// document does not pin its memory for the rest of the thread's life
+const size_t WORKSPACE_MAX_RETAINED_SIZE = 64 << 20;
+
+Workspace::Workspace(size_t initialSize)
+    : buffer(new byte[initialSize]), bufferSize(initialSize)
+{
+    arena.emplace(buffer.get(), bufferSize, &overflow);
+}
+
+/**
+ * @brief Releases everything allocated since the last reset.
+ *
+ * If the previous document did not fit in the buffer, the buffer grows so
+ * that the next one of the same size is served without allocator calls.
+ */
+void Workspace::reset()
+{
+    // Must go before the buffer: the arena may still point into it
+    arena.reset();
+
+    if (overflow.overflowSize && bufferSize < WORKSPACE_MAX_RETAINED_SIZE)
+    {
+        size_t newSize = bufferSize;
+        while (newSize < bufferSize + overflow.overflowSize && newSize < WORKSPACE_MAX_RETAINED_SIZE)
+            newSize *= 2;
+
+        buffer.reset(new byte[newSize]);
+        bufferSize = newSize;
+    }
+    overflow.overflowSize = 0;
+
+    arena.emplace(buffer.get(), bufferSize, &overflow);
+}
+
+void *Workspace::OverflowResource::do_allocate(size_t bytes, size_t alignment)
+{
+    overflowSize += bytes;
+    return pmr::new_delete_resource()->allocate(bytes, alignment);
+}
+
+void Workspace::OverflowResource::do_deallocate(void *p, size_t bytes, size_t alignment)
+{
+    pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+}
+
+bool Workspace::OverflowResource::do_is_equal(const pmr::memory_resource &other) const noexcept
+{
+    return this == &other;
+}
+
+/**
+ * @brief Returns the reusable workspace of the calling thread.
+ */
+Workspace &getThreadWorkspace()
+{
+    thread_local Workspace workspace;
+    return workspace;
+}
@@ -0,0 +1,79 @@
+/**
+ * @brief Lequel? per-thread scratch memory for transient engine structures
+ * @author Dylan Frigerio, Micaela Dinsen
+ *
+ * @copyright Copyright (c) 2022-2023
+ *
+ * A Workspace is a monotonic arena: allocations are a pointer bump and
+ * deallocations are free. Everything is released at once when the outermost
+ * Workspace::Scope ends, so a document costs no allocator calls once the
+ * arena has grown to fit the largest document seen by its thread.
+ */
+
+#ifndef WORKSPACE_H
+#define WORKSPACE_H
+
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+#include <optional>
+
+class Workspace
+{
+public:
+    explicit Workspace(size_t initialSize = 1 << 20);
+
+    Workspace(const Workspace &) = delete;
+    Workspace &operator=(const Workspace &) = delete;
+
+    std::pmr::memory_resource *getResource() { return &*arena; }
+
+    /**
+     * @brief Marks the lifetime of one document's transient structures.
+     *
+     * Scopes nest: only the outermost one releases the arena when it ends,
+     * so a caller can place its Text in the workspace and then call into
+     * the engine, which opens its own inner scope.
+     */
+    class Scope
+    {
+    public:
+        explicit Scope(Workspace &workspace) : workspace(workspace) { workspace.depth++; }
+        ~Scope()
+        {
+            if (--workspace.depth == 0)
+                workspace.reset();
+        }
+
+        Scope(const Scope &) = delete;
+        Scope &operator=(const Scope &) = delete;
+
+    private:
+        Workspace &workspace;
+    };
+
+private:
+    // Counts what the arena had to request beyond its preallocated buffer
+    class OverflowResource : public std::pmr::memory_resource
+    {
+    public:
+        size_t overflowSize = 0;
+
+    private:
+        void *do_allocate(size_t bytes, size_t alignment) override;
+        void do_deallocate(void *p, size_t bytes, size_t alignment) override;
+        bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override;
+    };
+
+    void reset();
+
+    std::unique_ptr<std::byte[]> buffer;
+    size_t bufferSize;
+    OverflowResource overflow;
+    std::optional<std::pmr::monotonic_buffer_resource> arena;
+    int depth = 0;
+};
+
+Workspace &getThreadWorkspace();
+
+#endif
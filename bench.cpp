@@ -0,0 +1,170 @@
+/**
+ * @brief Lequel? accuracy and speed benchmark
+ * @author Dylan Frigerio, Micaela Dinsen
+ *
+ * @copyright Copyright (c) 2022-2023
+ *
+ * Usage: lequel-bench [--sizes n1,n2,...] [--repeat count] [--perf] corpus_dir
+ *
+ * Every file in corpus_dir is a test document whose expected language is
+ * the start of its file name, up to the first '_' or '.' (eng_01.txt,
+ * spa.txt). For each profile size N, the model is loaded keeping the top N
+ * trigrams of every language, and all documents are identified. The table
+ * shows accuracy, estimated model memory and throughput. With --perf, every
+ * row is followed by the CPU time, instructions per cycle and cache and
+ * branch misses per trigram of each engine stage.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "Lequel.h"
+#include "Metrics.h"
+#include "Model.h"
+#include "PerfCounters.h"
+
+using namespace std;
+using namespace std::chrono;
+
+const char BENCH_DEFAULT_SIZES[] = "50,100,200,300,500,750,1000,1500,2000";
+
+struct BenchDocument
+{
+    string languageCode;
+    Text text;
+};
+
+/**
+ * @brief Loads every file of the corpus directory, sorted by name.
+ */
+static bool loadBenchCorpus(const string &path, vector<BenchDocument> &documents)
+{
+    error_code error;
+    vector<filesystem::path> documentPaths;
+    for (const auto &entry : filesystem::directory_iterator(path, error))
+    {
+        if (entry.is_regular_file())
+            documentPaths.push_back(entry.path());
+    }
+    if (error)
+    {
+        cerr << "Error while reading directory " << path << ": " << error.message() << endl;
+        return false;
+    }
+    sort(documentPaths.begin(), documentPaths.end());
+
+    for (const auto &documentPath : documentPaths)
+    {
+        string fileName = documentPath.filename().string();
+
+        BenchDocument document;
+        document.languageCode = fileName.substr(0, fileName.find_first_of("_."));
+        if (!getTextFromFile(documentPath.string(), document.text))
+            return false;
+
+        documents.push_back(move(document));
+    }
+    return true;
+}
+
+static vector<size_t> parseSizes(const string &list)
+{
+    vector<size_t> sizes;
+    stringstream stream(list);
+    string item;
+
+    while (getline(stream, item, ','))
+    {
+        if (!item.empty())
+            sizes.push_back(stoul(item));
+    }
+    return sizes;
+}
+
+int main(int argc, char *argv[])
+{
+    string sizeList = BENCH_DEFAULT_SIZES;
+    int repeatNum = 1;
+    bool countPerf = false;
+    string corpusPath;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--sizes") && i + 1 < argc)
+            sizeList = argv[++i];
+        else if (!strcmp(argv[i], "--repeat") && i + 1 < argc)
+            repeatNum = max(stoi(argv[++i]), 1);
+        else if (!strcmp(argv[i], "--perf"))
+            countPerf = true;
+        else
+            corpusPath = argv[i];
+    }
+
+    if (corpusPath.empty())
+    {
+        cerr << "Usage: lequel-bench [--sizes n1,n2,...] [--repeat count] [--perf] corpus_dir" << endl;
+        return 1;
+    }
+
+    vector<BenchDocument> documents;
+    if (!loadBenchCorpus(corpusPath, documents) || documents.empty())
+    {
+        cerr << "Could not load benchmark corpus" << endl;
+        return 1;
+    }
+
+    if (countPerf)
+        countPerf = startPerfCounters();
+
+    printf("%6s %10s %11s %12s\n", "N", "accuracy", "model MiB", "docs/s");
+
+    Workspace &workspace = getThreadWorkspace();
+    for (size_t maxTrigrams : parseSizes(sizeList))
+    {
+        map<string, string> languageCodeNames;
+        LanguageProfiles languages;
+
+        if (!loadLanguagesData(languageCodeNames, languages, maxTrigrams))
+        {
+            cerr << "Could not load language data" << endl;
+            return 1;
+        }
+
+        resetPerfCounters();
+        uint64_t startTrigramCount = getMetricCount(MetricCounter::TrigramsCounted);
+
+        size_t correctNum = 0;
+        auto startTime = steady_clock::now();
+
+        for (int repeat = 0; repeat < repeatNum; repeat++)
+        {
+            for (const auto &document : documents)
+            {
+                if (identifyLanguage(document.text, languages, workspace) == document.languageCode)
+                    correctNum++;
+            }
+        }
+
+        double seconds = duration<double>(steady_clock::now() - startTime).count();
+        size_t runNum = documents.size() * repeatNum;
+
+        printf("%6zu %9.2f%% %11.2f %12.1f\n",
+               maxTrigrams,
+               100.0 * correctNum / runNum,
+               getModelMemoryUsage(languages) / (1024.0 * 1024.0),
+               runNum / max(seconds, 1e-9));
+
+        if (countPerf)
+            printf("%s\n", getPerfReport(getMetricCount(MetricCounter::TrigramsCounted) - startTrigramCount).c_str());
+    }
+
+    return 0;
+}
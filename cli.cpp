@@ -0,0 +1,279 @@
+/**
+ * @brief Lequel? command line interface
+ * @author Dylan Frigerio, Micaela Dinsen
+ *
+ * @copyright Copyright (c) 2022-2023
+ *
+ * Usage: lequel-cli [--metrics] [--max-trigrams N] [--lazy] [-j threads]
+ *                   [--max-bytes N] [--bounded]
+ *                   [--sample K] [--window W] [--cache-size N]
+ *                   [--cache path] [--cache-profiles] [--trace path]
+ *                   [--perf] [file|directory...]
+ *
+ * Identifies each file (or standard input when no file is given; every file
+ * below a directory) and prints one "path<TAB>code<TAB>name" line per
+ * document. --max-trigrams keeps only the N most frequent trigrams of each
+ * language profile. --lazy loads only the profiles of languages that share a
+ * script with each document. Large documents are profiled with -j threads
+ * (all cores by default). Only the first --max-bytes of each document are
+ * read (10 MB by default, 0 reads whole documents). --bounded keeps exact
+ * counts only for trigrams of the model and caps the memory of each document
+ * profile (not with --lazy, which never holds the whole model). --sample
+ * reads only K evenly spaced windows of W bytes (4096 by default) of larger
+ * files, and adds the fraction of each file that was read as a fourth
+ * column. Repeated documents are answered from an LRU cache of --cache-size
+ * results (4096 by default, 0 disables it). --cache keeps results in a file
+ * across runs, so unchanged files are not read again; with --cache-profiles
+ * it also keeps each document profile, so a model change only rescores them
+ * (not with --lazy or --bounded; a profile read with other --max-bytes,
+ * --sample or --window settings is read again). Files not looked up in a
+ * run are dropped from the cache file. With --metrics, the engine metrics are
+ * written to stderr as JSON on exit. SIGUSR1 dumps them at any time.
+ * --trace writes a timeline of the run (model load, reads, decoding,
+ * trigram extraction, normalization and scoring of every language, per
+ * thread) as Chrome trace-event JSON, for chrome://tracing or Perfetto.
+ * --perf writes the CPU time, instructions per cycle and cache and branch
+ * misses per trigram of each engine stage to stderr on exit (hardware
+ * counters the kernel does not expose show as n/a).
+ */
+
+#include <algorithm>
+#include <csignal>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include "Lequel.h"
+#include "Metrics.h"
+#include "DiskCache.h"
+#include "Model.h"
+#include "PerfCounters.h"
+#include "ResultCache.h"
+#include "ThreadPool.h"
+#include "Trace.h"
+
+using namespace std;
+
+/**
+ * @brief Dumps the metrics to stderr every time SIGUSR1 arrives.
+ *
+ * SIGUSR1 must be blocked in every thread, so it is only delivered here.
+ */
+static void metricsSignalLoop(sigset_t signals)
+{
+    int signal;
+    while (sigwait(&signals, &signal) == 0)
+        cerr << getMetricsJSON() << endl;
+}
+
+int main(int argc, char *argv[])
+{
+    bool dumpMetrics = false;
+    size_t maxTrigrams = 0;
+    bool isLazy = false;
+    unsigned threadNum = 0;
+    size_t maxBytes = TEXT_MAX_FILE_SIZE;
+    bool isBounded = false;
+    size_t windowNum = 0;
+    size_t windowSize = 4096;
+    size_t cacheSize = 4096;
+    string diskCachePath;
+    bool cacheProfiles = false;
+    string tracePath;
+    bool countPerf = false;
+    vector<string> paths;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--metrics"))
+            dumpMetrics = true;
+        else if (!strcmp(argv[i], "--max-trigrams") && i + 1 < argc)
+            maxTrigrams = stoul(argv[++i]);
+        else if (!strcmp(argv[i], "--lazy"))
+            isLazy = true;
+        else if (!strcmp(argv[i], "-j") && i + 1 < argc)
+            threadNum = stoul(argv[++i]);
+        else if (!strcmp(argv[i], "--bounded"))
+            isBounded = true;
+        else if (!strcmp(argv[i], "--sample") && i + 1 < argc)
+            windowNum = stoul(argv[++i]);
+        else if (!strcmp(argv[i], "--window") && i + 1 < argc)
+            windowSize = stoul(argv[++i]);
+        else if (!strcmp(argv[i], "--cache-size") && i + 1 < argc)
+            cacheSize = stoul(argv[++i]);
+        else if (!strcmp(argv[i], "--cache") && i + 1 < argc)
+            diskCachePath = argv[++i];
+        else if (!strcmp(argv[i], "--cache-profiles"))
+            cacheProfiles = true;
+        else if (!strcmp(argv[i], "--trace") && i + 1 < argc)
+            tracePath = argv[++i];
+        else if (!strcmp(argv[i], "--perf"))
+            countPerf = true;
+        else if (!strcmp(argv[i], "--max-bytes") && i + 1 < argc)
+        {
+            maxBytes = stoull(argv[++i]);
+            if (!maxBytes)
+                maxBytes = SIZE_MAX;
+        }
+        else if (!strcmp(argv[i], "-"))
+            paths.push_back(argv[i]);
+        else
+            addTextFilePaths(argv[i], paths);
+    }
+
+    // Block SIGUSR1 before any thread starts, then serve it from its own thread
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+    thread(metricsSignalLoop, signals).detach();
+
+    if (!tracePath.empty())
+        startTrace();
+    if (countPerf)
+        countPerf = startPerfCounters();
+
+    map<string, string> languageCodeNames;
+    LanguageProfiles languages;
+    LazyModel lazyModel;
+
+    bool isLoaded = isLazy ? lazyModel.open(languageCodeNames, maxTrigrams)
+                           : loadLanguagesData(languageCodeNames, languages, maxTrigrams);
+    if (!isLoaded)
+    {
+        cerr << "Could not load language data" << endl;
+        return 1;
+    }
+
+    if (paths.empty())
+        paths.push_back("-");
+
+    ThreadPool pool(threadNum);
+    TrigramSet modelTrigrams;
+    ResultCache cache(cacheSize);
+
+    IdentifyOptions options;
+    options.pool = &pool;
+    options.cache = cacheSize ? &cache : nullptr;
+    if (isBounded && !isLazy)
+    {
+        modelTrigrams = getModelTrigrams(languages);
+        options.modelTrigrams = &modelTrigrams;
+    }
+
+    // Results depend on the model files and on these settings; stored
+    // profiles only on the read settings
+    DiskCache diskCache;
+    if (!diskCachePath.empty())
+    {
+        string readSettings = "sample=" + to_string(windowNum) + "x" + to_string(windowSize) +
+                              " max-bytes=" + to_string(maxBytes);
+        string settings = "lazy=" + to_string(isLazy) + " bounded=" + to_string(isBounded) + " " + readSettings;
+        if (!diskCache.open(diskCachePath, getModelVersion(languageCodeNames, maxTrigrams, settings), readSettings))
+            return 1;
+    }
+    // Stored profiles are rescored against the whole model
+    cacheProfiles = cacheProfiles && !isLazy && !isBounded;
+
+    Workspace &workspace = getThreadWorkspace();
+
+    int result = 0;
+    for (const string &path : paths)
+    {
+        TRACE_SCOPE("document", path);
+        Workspace::Scope scope(workspace);
+        Text text(workspace.getResource());
+        LanguageGuess guess;
+        double sampledFraction = 0.0;
+
+        FileIdentity identity;
+        bool isCacheable = !diskCachePath.empty() && path != "-" && getFileIdentity(path, identity);
+        bool isCached = isCacheable && diskCache.getResult(identity, guess, &sampledFraction);
+
+        // Only the model changed: rescore the stored profile
+        if (!isCached && isCacheable && !isLazy && !isBounded)
+        {
+            TrigramProfile profile(workspace.getResource());
+            if (diskCache.getProfile(identity, profile, &sampledFraction))
+            {
+                guess = guessLanguage(profile, languages);
+                diskCache.put(identity, guess, sampledFraction);
+                isCached = true;
+            }
+        }
+
+        if (!isCached)
+        {
+            bool success;
+            sampledFraction = 1.0;
+
+            if (path == "-")
+                success = getTextFromDescriptor(STDIN_FILENO, text, maxBytes);
+            else if (windowNum)
+                success = getSampledTextFromFile(path, text, windowNum, windowSize, &sampledFraction, maxBytes);
+            else
+                success = getTextFromFile(path, text, maxBytes);
+
+            if (!success)
+            {
+                result = 1;
+                continue;
+            }
+
+            if (isCacheable && cacheProfiles)
+            {
+                TrigramProfile profile(workspace.getResource());
+                buildTrigramProfile(text, profile, pool);
+                normalizeTrigramProfile(profile);
+
+                guess = guessLanguage(profile, languages);
+                diskCache.put(identity, guess, sampledFraction, &profile);
+            }
+            else
+            {
+                guess = isLazy ? guessLanguage(text, lazyModel.getCandidates(text), workspace, options)
+                               : guessLanguage(text, languages, workspace, options);
+                if (isCacheable)
+                    diskCache.put(identity, guess, sampledFraction);
+            }
+        }
+
+        const string &languageCode = guess.languageCode;
+        auto it = languageCodeNames.find(languageCode);
+        string languageName = (it != languageCodeNames.end()) ? it->second : "Unknown";
+
+        cout << path << '\t' << languageCode << '\t' << languageName;
+        if (windowNum)
+            cout << '\t' << sampledFraction;
+        cout << '\n';
+    }
+    cout.flush();
+
+    if (!diskCache.save())
+        result = 1;
+
+    if (dumpMetrics)
+        cerr << getMetricsJSON() << endl;
+
+    if (countPerf)
+    {
+        stopPerfCounters();
+        cerr << getPerfReport(getMetricCount(MetricCounter::TrigramsCounted));
+    }
+
+    if (!tracePath.empty())
+    {
+        stopTrace();
+        if (!writeTraceJSON(tracePath))
+            result = 1;
+    }
+
+    return result;
+}
@@ -6,70 +6,255 @@
  * @copyright Copyright (c) 2022-2023
  */
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
 #include <iostream>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <string>
-#include <chrono>
+#include <vector>
 
 #include "raylib.h"
 #include "CSVData.h"
 #include "Lequel.h"
+#include "MappedFile.h"
+#include "Model.h"
+#include "ResultCache.h"
+#include "ThreadPool.h"
 
 using namespace std;
 using namespace std::chrono;
 
-const string LANGUAGECODE_NAMES_FILE = "resources/languagecode_names_es.csv";
-const string TRIGRAMS_PATH = "resources/trigrams/";
+enum class AppState { WAITING, PROCESSING, RESULT_READY, BATCH };
 
-enum class AppState { WAITING, PROCESSING, RESULT_READY };
+enum class ModelState { LOADING, READY, FAILED };
+
+// Text and layout of a result, built once per result instead of every frame
+struct ResultLabel
+{
+    string languageText;
+    int languageX = 0;
+    string timeText;
+    int timeX = 0;
+};
 
 /**
- * @brief Loads all language profiles from CSV files.
- * @param languageCodeNames Map of ISO code → language name
- * @param languages Output vector of language profiles
+ * @brief Builds the label of a result.
+ *
+ * @param languageCode Identified language code, or "error"
+ * @param languageCodeNames Map of language codes to language names
+ * @param processingTimeMs Time taken, in ms
+ * @param screenWidth Window width, to center the label
+ * @param readFraction Fraction of the document read (less than 1 when the
+ *                     user stopped a progressive identification)
+ * @return ResultLabel The label
  */
-bool loadLanguagesData(map<string, string>& languageCodeNames, LanguageProfiles& languages)
+static ResultLabel getResultLabel(const string& languageCode,
+    const map<string, string>& languageCodeNames,
+    double processingTimeMs, int screenWidth, double readFraction = 1.0)
 {
-    CSVData languageCodesCSVData;
-    if (!readCSV(LANGUAGECODE_NAMES_FILE, languageCodesCSVData))
-        return false;
+    ResultLabel label;
 
-    // Iterate through CSV rows (code, name)
-    for (auto& fields : languageCodesCSVData)
-    {
-        if (fields.size() != 2)
-            continue;
+    if (languageCode == "error")
+        label.languageText = "Processing error";
+    else {
+        auto it = languageCodeNames.find(languageCode);
+        label.languageText = (it != languageCodeNames.end()) ? it->second : "Unknown";
+    }
+    label.languageX = (screenWidth - MeasureText(label.languageText.c_str(), 48)) / 2;
+
+    label.timeText = (processingTimeMs < 1000)
+        ? "Processing time: " + to_string(processingTimeMs) + " ms"
+        : "Processing time: " + to_string(processingTimeMs / 1000.0) + " s";
+    if (readFraction < 1.0) {
+        char buffer[64];
+        snprintf(buffer, sizeof(buffer), " (stopped at %.1f%% of the file)", readFraction * 100);
+        label.timeText += buffer;
+    }
+    label.timeX = (screenWidth - MeasureText(label.timeText.c_str(), 20)) / 2;
 
-        string languageCode = fields[0];
-        string languageName = fields[1];
-        languageCodeNames[languageCode] = languageName;
+    return label;
+}
 
-        CSVData languageCSVData;
-        if (!readCSV(TRIGRAMS_PATH + languageCode + ".csv", languageCSVData))
-            return false;
+// A single dropped file, identified progressively on the pool. The worker
+// publishes the best guesses after every chunk; the GUI shows them and can
+// stop the identification.
+struct FileJob
+{
+    mutex lock;
+    LanguageProgress progress = {};
+    size_t progressNum = 0;
+    bool isDone = false;
+    string languageCode;
+    double processingTimeMs = 0.0;
+    atomic<bool> isCancelled{false};
+};
 
-        languages.push_back(LanguageProfile());
-        LanguageProfile& language = languages.back();
-        language.languageCode = languageCode;
+// Best guesses so far and bytes read, built once per update
+struct ProgressLabel
+{
+    string lines[PROGRESS_GUESS_NUM];
+    int lineX[PROGRESS_GUESS_NUM] = {};
+    size_t lineNum = 0;
+    string bytesText;
+    int bytesX = 0;
+};
 
-        // Convert each trigram string to uint64_t
-        for (auto& fields : languageCSVData)
-        {
-            if (fields.size() != 2)
-                continue;
+/**
+ * @brief Identifies a dropped file on a worker, publishing its progress.
+ *
+ * @param job The job (shared with the GUI)
+ * @param path Path of the file
+ * @param languages The language profiles
+ */
+static void runFileJob(FileJob& job, const string& path, const LanguageProfiles& languages)
+{
+    auto startTime = high_resolution_clock::now();
+
+    MappedFile file;
+    string languageCode = "error";
+    if (file.open(path)) {
+        file.adviseSequential();
+        languageCode = guessLanguageProgressively(file.getData(), file.getSize(), languages,
+            getThreadWorkspace(), [&](const LanguageProgress& progress) {
+                lock_guard<mutex> guard(job.lock);
+                job.progress = progress;
+                job.progressNum++;
+                return !job.isCancelled.load(memory_order_relaxed);
+            }).languageCode;
+    }
 
-            string trigramString = fields[0];
-            float frequency = (float)stoi(fields[1]);
+    auto duration = duration_cast<microseconds>(high_resolution_clock::now() - startTime);
 
-            uint64_t trigramInt = stringTrigramToInt(trigramString);
-            if (trigramInt != 0) {
-                language.trigramProfile[trigramInt] = frequency;
-            }
-        }
+    lock_guard<mutex> guard(job.lock);
+    job.languageCode = languageCode;
+    job.processingTimeMs = duration.count() / 1000.0;
+    job.isDone = true;
+}
 
-        normalizeTrigramProfile(language.trigramProfile);
+/**
+ * @brief Builds the label of an intermediate result.
+ *
+ * @param progress The best guesses so far
+ * @param languageCodeNames Map of language codes to language names
+ * @param screenWidth Window width, to center the label
+ * @return ProgressLabel The label
+ */
+static ProgressLabel getProgressLabel(const LanguageProgress& progress,
+    const map<string, string>& languageCodeNames, int screenWidth)
+{
+    ProgressLabel label;
+    char buffer[128];
+
+    label.lineNum = progress.guessNum;
+    for (size_t i = 0; i < progress.guessNum; i++) {
+        const LanguageGuess& guess = progress.guesses[i];
+        auto it = languageCodeNames.find(guess.languageCode);
+        snprintf(buffer, sizeof(buffer), "%s  %.3f",
+            (it != languageCodeNames.end()) ? it->second.c_str() : "Unknown", guess.similarity);
+
+        label.lines[i] = buffer;
+        label.lineX[i] = (screenWidth - MeasureText(buffer, i ? 20 : 36)) / 2;
     }
-    return true;
+
+    snprintf(buffer, sizeof(buffer), "%.2f of %.2f MB read - press space to stop",
+        progress.processedBytes / 1e6, progress.totalBytes / 1e6);
+    label.bytesText = buffer;
+    label.bytesX = (screenWidth - MeasureText(buffer, 20)) / 2;
+
+    return label;
+}
+
+// One row of the batch table, formatted by the worker that identified the file
+struct BatchRow
+{
+    string pathText;
+    string languageText;
+    string scoreText;
+    string timeText;
+    size_t byteNum = 0;
+    high_resolution_clock::time_point finishTime;
+};
+
+// Batch table layout
+const int BATCH_HEADER_Y = 100;
+const int BATCH_FIRST_ROW_Y = 128;
+const int BATCH_ROW_HEIGHT = 22;
+const int BATCH_FOOTER_HEIGHT = 30;
+const size_t BATCH_PATH_MAX_SIZE = 38;
+
+/**
+ * @brief Identifies a dropped file and formats its table row. Runs on a
+ *        worker of the pool.
+ *
+ * @param path Path of the file
+ * @param languageCodeNames Map of language codes to language names
+ * @param languages The language profiles
+ * @param options Identification options (shared by all workers)
+ * @return BatchRow The row
+ */
+static BatchRow identifyBatchFile(const string& path,
+    const map<string, string>& languageCodeNames,
+    const LanguageProfiles& languages, const IdentifyOptions& options)
+{
+    auto startTime = high_resolution_clock::now();
+
+    Workspace& workspace = getThreadWorkspace();
+    Workspace::Scope scope(workspace);
+    Text text(workspace.getResource());
+
+    BatchRow row;
+    char buffer[32];
+
+    if (getTextFromFile(path, text)) {
+        LanguageGuess guess = guessLanguage(text, languages, workspace, options);
+
+        auto it = languageCodeNames.find(guess.languageCode);
+        row.languageText = (it != languageCodeNames.end()) ? it->second : "Unknown";
+        snprintf(buffer, sizeof(buffer), "%.3f", guess.similarity);
+        row.scoreText = buffer;
+    }
+    else {
+        row.languageText = "Processing error";
+        row.scoreText = "-";
+    }
+
+    error_code error;
+    uintmax_t fileSize = filesystem::file_size(path, error);
+    row.byteNum = error ? 0 : (size_t)min(fileSize, (uintmax_t)TEXT_MAX_FILE_SIZE);
+
+    // Keep the end of long paths, without cutting a UTF-8 sequence
+    row.pathText = path;
+    if (path.size() > BATCH_PATH_MAX_SIZE) {
+        size_t start = path.size() - BATCH_PATH_MAX_SIZE + 3;
+        while (start < path.size() && ((unsigned char)path[start] & 0xC0) == 0x80)
+            start++;
+        row.pathText = "..." + path.substr(start);
+    }
+
+    row.finishTime = high_resolution_clock::now();
+    auto duration = duration_cast<microseconds>(row.finishTime - startTime);
+    snprintf(buffer, sizeof(buffer), "%.1f ms", duration.count() / 1000.0);
+    row.timeText = buffer;
+
+    return row;
+}
+
+/**
+ * @brief Builds the batch summary line: progress and aggregate throughput.
+ */
+static string getBatchSummary(size_t doneNum, size_t fileNum, size_t byteNum, double seconds)
+{
+    char buffer[128];
+    double megabytes = byteNum / 1e6;
+    snprintf(buffer, sizeof(buffer), "%zu/%zu files, %.2f MB in %.2f s (%.2f MB/s, %.1f files/s)",
+        doneNum, fileNum, megabytes, seconds,
+        seconds > 0 ? megabytes / seconds : 0.0, seconds > 0 ? doneNum / seconds : 0.0);
+    return buffer;
 }
 
 int main(int, char* [])
@@ -77,26 +262,109 @@ int main(int, char* [])
     map<string, string> languageCodeNames;
     LanguageProfiles languages;
 
-    if (!loadLanguagesData(languageCodeNames, languages))
-        return 1;
+    // Pasting the same snippet again skips the identification
+    const size_t RESULT_CACHE_SIZE = 256;
+    ResultCache resultCache(RESULT_CACHE_SIZE);
+    IdentifyOptions identifyOptions;
+    identifyOptions.cache = &resultCache;
+
+    // Dropped batches: workers append finished rows, the main loop moves
+    // them to the table
+    mutex batchLock;
+    vector<BatchRow> finishedBatchRows;
+    atomic<bool> isClosing{false};
+
+    // The window opens at once; the profiles load on a worker meanwhile.
+    // languageCodeNames and languages belong to the loader until READY.
+    ModelLoadProgress loadProgress;
+    atomic<ModelState> modelState{ModelState::LOADING};
+
+    // Declared after the state its workers use, so they stop before it is gone
+    ThreadPool pool;
 
     int screenWidth = 800, screenHeight = 450;
     InitWindow(screenWidth, screenHeight, "Lequel?");
     SetTargetFPS(60);
 
+    pool.submit([&]() {
+        bool isLoaded = loadLanguagesData(languageCodeNames, languages, 0, &loadProgress);
+        modelState.store(isLoaded ? ModelState::READY : ModelState::FAILED, memory_order_release);
+    });
+
+    size_t shownLoadedCount = SIZE_MAX, shownLanguageCount = 0;
+    string loadingText;
+    int loadingX = 0;
+    const char* loadErrorText = "Could not load language data";
+    const int loadErrorX = (screenWidth - MeasureText(loadErrorText, 24)) / 2;
+    const char* queuedText = "Loading languages...";
+    const int queuedX = (screenWidth - MeasureText(queuedText, 48)) / 2;
+
+    // Input that arrives while the profiles load waits in these
+    vector<string> pendingDrops;
+    bool isModelReady = false;
+
+    // Redraw the progress bar until the profiles are loaded; then sleep in
+    // EndDrawing() until an input event arrives, instead of redrawing at 60 FPS
+    DisableEventWaiting();
+
+    const char* processingText = "Processing...";
+    const int processingX = (screenWidth - MeasureText(processingText, 48)) / 2;
+
     AppState currentState = AppState::WAITING;
-    string languageCode = "---";
+    ResultLabel resultLabel;
     double processingTimeMs = 0.0;
     high_resolution_clock::time_point startTime;
     bool processing = false;
     bool loadedText = false;
-    string pendingClipboard, pendingFilePath;
-    bool isFromFile = false;
+    string pendingClipboard;
+
+    shared_ptr<FileJob> fileJob;
+    size_t shownProgressNum = 0;
+    ProgressLabel progressLabel;
+
+    vector<BatchRow> batchRows;
+    size_t batchFileNum = 0;
+    size_t batchByteNum = 0;
+    high_resolution_clock::time_point batchStartTime, batchEndTime;
+    string batchSummary;
+    size_t batchScrollRow = 0;
+    const size_t batchVisibleRowNum =
+        (screenHeight - BATCH_FIRST_ROW_Y - BATCH_FOOTER_HEIGHT) / BATCH_ROW_HEIGHT;
 
     while (!WindowShouldClose())
     {
-        // Handle clipboard paste
-        if (IsKeyPressed(KEY_V) &&
+        ModelState currentModelState = modelState.load(memory_order_acquire);
+        if (!isModelReady && currentModelState != ModelState::LOADING) {
+            isModelReady = (currentModelState == ModelState::READY);
+            if (!isModelReady) {
+                // Queued input has nothing to run against
+                currentState = AppState::WAITING;
+                loadedText = false;
+                pendingClipboard.clear();
+                pendingDrops.clear();
+            }
+            // A queued paste still needs the next frame
+            if (!loadedText)
+                EnableEventWaiting();
+        }
+        else if (currentModelState == ModelState::LOADING) {
+            size_t loadedCount = loadProgress.loadedCount.load(memory_order_relaxed);
+            size_t languageCount = loadProgress.languageCount.load(memory_order_relaxed);
+            if (loadedCount != shownLoadedCount || languageCount != shownLanguageCount) {
+                shownLoadedCount = loadedCount;
+                shownLanguageCount = languageCount;
+                loadingText = "Loading languages: " + to_string(loadedCount) + "/" +
+                    to_string(languageCount);
+                loadingX = (screenWidth - MeasureText(loadingText.c_str(), 20)) / 2;
+            }
+        }
+
+        bool isBatchRunning = (currentState == AppState::BATCH) &&
+            (batchRows.size() < batchFileNum);
+
+        // Handle clipboard paste (queued while the profiles load)
+        if (currentModelState != ModelState::FAILED &&
+            !isBatchRunning && !fileJob && IsKeyPressed(KEY_V) &&
             (IsKeyDown(KEY_LEFT_CONTROL) || IsKeyDown(KEY_RIGHT_CONTROL) ||
                 IsKeyDown(KEY_LEFT_SUPER) || IsKeyDown(KEY_RIGHT_SUPER)))
         {
@@ -104,116 +372,286 @@ int main(int, char* [])
             currentState = AppState::PROCESSING;
             loadedText = true;
             pendingClipboard = GetClipboardText();
-            isFromFile = false;
+            DisableEventWaiting();
         }
 
-        // Handle file drag & drop
+        // Handle file drag & drop (queued while the profiles load)
         if (IsFileDropped())
         {
             FilePathList droppedFiles = LoadDroppedFiles();
-            if (droppedFiles.count == 1)
-            {
-                processing = true;
-                currentState = AppState::PROCESSING;
-                loadedText = true;
-                pendingFilePath = droppedFiles.paths[0];
-                isFromFile = true;
+            if (currentModelState != ModelState::FAILED) {
+                for (unsigned i = 0; i < droppedFiles.count; i++)
+                    pendingDrops.push_back(droppedFiles.paths[i]);
             }
             UnloadDroppedFiles(droppedFiles);
         }
 
-        // Once input is loaded, process text
-        if (loadedText && !processing && currentState == AppState::PROCESSING)
+        // Files dropped while a single file is read wait until it is done
+        // or stopped
+        if (isModelReady && !pendingDrops.empty() && !fileJob)
         {
-            startTime = high_resolution_clock::now();
+            bool isSingleFile = (pendingDrops.size() == 1) &&
+                !DirectoryExists(pendingDrops[0].c_str());
 
-            Text text;
-            bool success = false;
-
-            if (isFromFile) {
-                success = getTextFromFile(pendingFilePath, text);
-                pendingFilePath.clear();
+            if (isSingleFile && currentState != AppState::BATCH)
+            {
+                currentState = AppState::PROCESSING;
+                fileJob = make_shared<FileJob>();
+                shownProgressNum = 0;
+
+                string path = pendingDrops[0];
+                pool.submit([&languages, job = fileJob, path]() {
+                    runFileJob(*job, path, languages);
+                });
+                DisableEventWaiting();
             }
-            else {
-                success = getTextFromString(pendingClipboard, text);
-                pendingClipboard.clear();
+            else
+            {
+                // Files dropped while a batch runs join it; otherwise a new
+                // table starts
+                if (!isBatchRunning) {
+                    batchRows.clear();
+                    batchFileNum = 0;
+                    batchByteNum = 0;
+                    batchScrollRow = 0;
+                    batchStartTime = batchEndTime = high_resolution_clock::now();
+                }
+
+                vector<string> paths;
+                for (const string& droppedPath : pendingDrops)
+                    addTextFilePaths(droppedPath, paths);
+
+                for (const string& path : paths) {
+                    pool.submit([&, path]() {
+                        if (isClosing.load(memory_order_relaxed))
+                            return;
+
+                        BatchRow row = identifyBatchFile(path, languageCodeNames, languages,
+                            identifyOptions);
+                        lock_guard<mutex> guard(batchLock);
+                        finishedBatchRows.push_back(move(row));
+                    });
+                }
+                batchFileNum += paths.size();
+                batchSummary = getBatchSummary(batchRows.size(), batchFileNum, batchByteNum, 0.0);
+
+                currentState = AppState::BATCH;
+                isBatchRunning = batchRows.size() < batchFileNum;
+                if (isBatchRunning)
+                    DisableEventWaiting();
             }
+            pendingDrops.clear();
+        }
 
-            if (success) {
-                languageCode = identifyLanguage(text, languages);
+        // Stream finished rows into the batch table
+        if (isBatchRunning)
+        {
+            vector<BatchRow> rows;
+            {
+                lock_guard<mutex> guard(batchLock);
+                rows.swap(finishedBatchRows);
             }
-            else {
-                languageCode = "error";
+
+            // Follow new rows while scrolled to the bottom
+            size_t maxScrollRow = batchRows.size() > batchVisibleRowNum
+                ? batchRows.size() - batchVisibleRowNum : 0;
+            bool isFollowing = batchScrollRow >= maxScrollRow;
+
+            for (BatchRow& row : rows) {
+                batchByteNum += row.byteNum;
+                batchEndTime = max(batchEndTime, row.finishTime);
+                batchRows.push_back(move(row));
             }
 
+            if (isFollowing && batchRows.size() > batchVisibleRowNum)
+                batchScrollRow = batchRows.size() - batchVisibleRowNum;
+
+            auto now = (batchRows.size() < batchFileNum) ? high_resolution_clock::now() : batchEndTime;
+            double seconds = duration_cast<microseconds>(now - batchStartTime).count() / 1e6;
+            batchSummary = getBatchSummary(batchRows.size(), batchFileNum, batchByteNum, seconds);
+
+            isBatchRunning = batchRows.size() < batchFileNum;
+            if (!isBatchRunning)
+                EnableEventWaiting();
+        }
+
+        // Scroll the batch table
+        if (currentState == AppState::BATCH)
+        {
+            long scrollRow = (long)batchScrollRow;
+            scrollRow -= (long)(GetMouseWheelMove() * 3);
+            if (IsKeyPressed(KEY_UP))
+                scrollRow--;
+            if (IsKeyPressed(KEY_DOWN))
+                scrollRow++;
+            if (IsKeyPressed(KEY_PAGE_UP))
+                scrollRow -= (long)batchVisibleRowNum;
+            if (IsKeyPressed(KEY_PAGE_DOWN))
+                scrollRow += (long)batchVisibleRowNum;
+            if (IsKeyPressed(KEY_HOME))
+                scrollRow = 0;
+            if (IsKeyPressed(KEY_END))
+                scrollRow = (long)batchRows.size();
+
+            long maxScrollRow = max((long)batchRows.size() - (long)batchVisibleRowNum, 0L);
+            batchScrollRow = (size_t)clamp(scrollRow, 0L, maxScrollRow);
+        }
+
+        // Once input is loaded, process text
+        if (isModelReady && loadedText && !processing && currentState == AppState::PROCESSING)
+        {
+            startTime = high_resolution_clock::now();
+
+            // The text and its trigram profile share the thread's arena
+            Workspace& workspace = getThreadWorkspace();
+            Workspace::Scope scope(workspace);
+            Text text(workspace.getResource());
+            bool success = getTextFromString(pendingClipboard, text);
+            pendingClipboard.clear();
+
+            string languageCode = "error";
+            if (success)
+                languageCode = guessLanguage(text, languages, workspace, identifyOptions).languageCode;
+
             auto endTime = high_resolution_clock::now();
             auto duration = duration_cast<microseconds>(endTime - startTime);
             processingTimeMs = duration.count() / 1000.0;
 
+            resultLabel = getResultLabel(languageCode, languageCodeNames, processingTimeMs, screenWidth);
             currentState = AppState::RESULT_READY;
+            loadedText = false;
+            EnableEventWaiting();
         }
 
+        // Show the best guesses of a dropped file as they improve
+        bool isFileJobDone = false;
+        if (fileJob)
+        {
+            if (IsKeyPressed(KEY_SPACE))
+                fileJob->isCancelled = true;
+
+            lock_guard<mutex> guard(fileJob->lock);
+            if (fileJob->progressNum != shownProgressNum) {
+                shownProgressNum = fileJob->progressNum;
+                progressLabel = getProgressLabel(fileJob->progress, languageCodeNames, screenWidth);
+            }
+
+            if (fileJob->isDone) {
+                const LanguageProgress& progress = fileJob->progress;
+                double readFraction = progress.totalBytes
+                    ? (double)progress.processedBytes / progress.totalBytes : 1.0;
+
+                resultLabel = getResultLabel(fileJob->languageCode, languageCodeNames,
+                    fileJob->processingTimeMs, screenWidth, readFraction);
+                currentState = AppState::RESULT_READY;
+                isFileJobDone = true;
+                // Queued drops start on the next frame
+                if (pendingDrops.empty())
+                    EnableEventWaiting();
+            }
+        }
+        if (isFileJobDone)
+            fileJob.reset();
+
         // --- Rendering ---
         BeginDrawing();
         ClearBackground(BEIGE);
 
-        DrawText("Lequel?", 80, 80, 128, BROWN);
-        DrawText("Copy and paste with Ctrl+V, or drag a file...", 80, 220, 24, BROWN);
+        if (currentState != AppState::BATCH) {
+            DrawText("Lequel?", 80, 80, 128, BROWN);
+            DrawText("Copy and paste with Ctrl+V, or drag files...", 80, 220, 24, BROWN);
+        }
 
         switch (currentState)
         {
+        case AppState::BATCH:
+        {
+            DrawText("Lequel?", 20, 15, 40, BROWN);
+            DrawText(batchSummary.c_str(), 20, 65, 20, DARKBROWN);
+
+            DrawText("File", 20, BATCH_HEADER_Y, 20, BROWN);
+            DrawText("Language", 430, BATCH_HEADER_Y, 20, BROWN);
+            DrawText("Score", 610, BATCH_HEADER_Y, 20, BROWN);
+            DrawText("Time", 690, BATCH_HEADER_Y, 20, BROWN);
+
+            size_t lastRow = min(batchScrollRow + batchVisibleRowNum, batchRows.size());
+            for (size_t i = batchScrollRow; i < lastRow; i++) {
+                const BatchRow& row = batchRows[i];
+                int y = BATCH_FIRST_ROW_Y + (int)(i - batchScrollRow) * BATCH_ROW_HEIGHT;
+
+                DrawText(row.pathText.c_str(), 20, y, 20, DARKBROWN);
+                DrawText(row.languageText.c_str(), 430, y, 20, DARKBROWN);
+                DrawText(row.scoreText.c_str(), 610, y, 20, DARKBROWN);
+                DrawText(row.timeText.c_str(), 690, y, 20, DARKBROWN);
+            }
+
+            DrawText(isBatchRunning ? "Drop more files to add them. Scroll with the wheel or arrows."
+                                    : "Press space to clear, or drop files for a new table. Scroll with the wheel or arrows.",
+                20, screenHeight - BATCH_FOOTER_HEIGHT + 8, 16, BROWN);
+            break;
+        }
+
         case AppState::WAITING:
             break;
 
         case AppState::PROCESSING:
-            DrawText("Processing...", (screenWidth - MeasureText("Processing...", 48)) / 2, 315, 48, DARKBROWN);
+            if (fileJob && shownProgressNum) {
+                DrawText(progressLabel.lines[0].c_str(), progressLabel.lineX[0], 262, 36, DARKBROWN);
+                for (size_t i = 1; i < progressLabel.lineNum; i++)
+                    DrawText(progressLabel.lines[i].c_str(), progressLabel.lineX[i],
+                        280 + 26 * (int)i, 20, DARKBROWN);
+                DrawText(progressLabel.bytesText.c_str(), progressLabel.bytesX, 375, 20, BROWN);
+                break;
+            }
+            if (!isModelReady) {
+                DrawText(queuedText, queuedX, 315, 48, DARKBROWN);
+                break;
+            }
+            DrawText(processingText, processingX, 315, 48, DARKBROWN);
             processing = false;
             break;
 
         case AppState::RESULT_READY:
-        {
-            string languageString;
-            if (languageCode == "error") {
-                languageString = "Processing error";
-            }
-            else if (languageCode != "---") {
-                if (languageCodeNames.find(languageCode) != languageCodeNames.end())
-                    languageString = languageCodeNames[languageCode];
-                else
-                    languageString = "Unknown";
-            }
-
-            if (!languageString.empty()) {
-                DrawText(languageString.c_str(),
-                    (screenWidth - MeasureText(languageString.c_str(), 48)) / 2,
-                    315, 48, DARKBROWN);
-
-                // Show processing time
-                string timeText = (processingTimeMs < 1000)
-                    ? "Processing time: " + to_string(processingTimeMs) + " ms"
-                    : "Processing time: " + to_string(processingTimeMs / 1000.0) + " s";
-
-                DrawText(timeText.c_str(),
-                    (screenWidth - MeasureText(timeText.c_str(), 20)) / 2,
-                    375, 20, DARKBROWN);
-            }
-
-            loadedText = false;
+            DrawText(resultLabel.languageText.c_str(), resultLabel.languageX, 315, 48, DARKBROWN);
+            // Show processing time
+            DrawText(resultLabel.timeText.c_str(), resultLabel.timeX, 375, 20, DARKBROWN);
             break;
         }
+
+        if (currentModelState == ModelState::LOADING) {
+            int barWidth = screenWidth - 160;
+            int filledWidth = shownLanguageCount
+                ? (int)(barWidth * shownLoadedCount / shownLanguageCount) : 0;
+
+            DrawText(loadingText.c_str(), loadingX, 385, 20, BROWN);
+            DrawRectangleLines(80, 415, barWidth, 12, BROWN);
+            DrawRectangle(80, 415, filledWidth, 12, BROWN);
         }
+        else if (currentModelState == ModelState::FAILED)
+            DrawText(loadErrorText, loadErrorX, 315, 24, MAROON);
 
         // Reset state on new input
-        if (currentState == AppState::RESULT_READY &&
+        if (currentState == AppState::RESULT_READY && !isFileJobDone &&
             (IsKeyPressed(KEY_V) || IsFileDropped() || IsKeyPressed(KEY_SPACE)))
         {
             currentState = AppState::WAITING;
-            languageCode = "---";
+        }
+        else if (currentState == AppState::BATCH && !isBatchRunning && IsKeyPressed(KEY_SPACE))
+        {
+            currentState = AppState::WAITING;
+            batchRows.clear();
         }
 
         EndDrawing();
     }
 
+    // Skip the files still queued, stop the one being read, and stop loading
+    // the profiles
+    isClosing = true;
+    loadProgress.isCancelled = true;
+    if (fileJob)
+        fileJob->isCancelled = true;
+
     CloseWindow();
     return 0;
 }
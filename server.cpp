@@ -0,0 +1,587 @@
+/**
+ * @brief Lequel? identification daemon over a Unix domain socket
+ * @author Dylan Frigerio, Micaela Dinsen
+ *
+ * @copyright Copyright (c) 2022-2023
+ *
+ * Usage: lequel-server [-j threads] [--max-trigrams N] [--cache-size N]
+ *                      [--trace path] socket_path
+ *
+ * Protocol: every message (in both directions) is a 4-byte big-endian
+ * length followed by that many bytes. A request holds UTF-8 text; its
+ * response holds "code<TAB>similarity" (or "error" if the text could not
+ * be decoded). A client may pipeline any number of requests on one
+ * connection: responses come back in request order.
+ *
+ * One epoll loop owns every socket; the identifications run on a worker
+ * pool that shares a single loaded model. Workers hand their responses back
+ * through a queue and wake the loop with an eventfd. Results of repeated
+ * texts come from an LRU cache of --cache-size entries (65536 by default,
+ * 0 disables it). --trace records a timeline of the whole run and writes
+ * it as Chrome trace-event JSON on exit. SIGINT and SIGTERM stop
+ * the server; SIGUSR1 dumps the metrics to stderr as JSON.
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "Lequel.h"
+#include "Metrics.h"
+#include "Model.h"
+#include "ResultCache.h"
+#include "ThreadPool.h"
+#include "Trace.h"
+
+using namespace std;
+
+const size_t SERVER_MAX_MESSAGE_SIZE = 16 << 20;
+const size_t SERVER_MAX_PENDING_REQUESTS = 256; // Per connection, before reads pause
+const size_t SERVER_READ_SIZE = 64 << 10;
+const int SERVER_MAX_EVENTS = 64;
+
+struct Connection
+{
+    int fd;
+    string input;
+    string output;
+    uint64_t nextRequest = 0;               // Sequence number of the next request read
+    uint64_t nextResponse = 0;              // Sequence number of the next response to send
+    map<uint64_t, string> readyResponses;   // Finished out of order, waiting their turn
+    bool isReading = true;
+    bool isWriting = false;
+    bool isPeerClosed = false;              // Close once every response is sent
+};
+
+struct Completion
+{
+    uint64_t connectionId;
+    uint64_t sequence;
+    string response;
+};
+
+class Server
+{
+public:
+    Server(const LanguageProfiles &languages, unsigned threadNum, size_t cacheSize)
+        : languages(languages), cache(cacheSize), pool(make_unique<ThreadPool>(threadNum)) {}
+    ~Server();
+
+    bool start(const string &socketPath);
+    void run();
+
+private:
+    void acceptConnections();
+    void readConnection(uint64_t connectionId);
+    void writeConnection(uint64_t connectionId);
+    void drainCompletions();
+    void handleSignals();
+    void dispatchRequests(uint64_t connectionId, Connection &connection);
+    void updateEvents(uint64_t connectionId, Connection &connection);
+    void closeConnection(uint64_t connectionId);
+
+    const LanguageProfiles &languages;
+    ResultCache cache;
+    unique_ptr<ThreadPool> pool;
+    string socketPath;
+
+    int epollFd = -1;
+    int listenFd = -1;
+    int wakeFd = -1;
+    int signalFd = -1;
+    bool running = true;
+
+    uint64_t nextConnectionId = 0;
+    unordered_map<uint64_t, unique_ptr<Connection>> connections;
+
+    mutex completionLock;
+    vector<Completion> completions;
+};
+
+// Reserved epoll keys; connection ids start above them
+const uint64_t LISTEN_KEY = UINT64_MAX;
+const uint64_t WAKE_KEY = UINT64_MAX - 1;
+const uint64_t SIGNAL_KEY = UINT64_MAX - 2;
+
+/**
+ * @brief Signals served through the signalfd.
+ *
+ * They must be blocked in every thread, so main() blocks them before the
+ * worker pool starts.
+ */
+static sigset_t getServerSignals()
+{
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGUSR1);
+    sigaddset(&signals, SIGPIPE);
+    return signals;
+}
+
+static bool addToEpoll(int epollFd, int fd, uint32_t events, uint64_t key)
+{
+    epoll_event event = {};
+    event.events = events;
+    event.data.u64 = key;
+    return epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event) == 0;
+}
+
+static void appendMessage(string &output, const string &payload)
+{
+    uint32_t length = (uint32_t)payload.size();
+    char header[4] = {
+        (char)(length >> 24), (char)(length >> 16), (char)(length >> 8), (char)length,
+    };
+    output.append(header, sizeof(header));
+    output += payload;
+}
+
+Server::~Server()
+{
+    // Workers post to the completion queue and the eventfd: stop them first
+    pool.reset();
+
+    for (auto &[connectionId, connection] : connections)
+        close(connection->fd);
+
+    for (int fd : {listenFd, wakeFd, signalFd, epollFd})
+    {
+        if (fd >= 0)
+            close(fd);
+    }
+
+    if (!socketPath.empty())
+        unlink(socketPath.c_str());
+}
+
+/**
+ * @brief Creates the listening socket, the wake-up eventfd and the signalfd.
+ *
+ * @param path Path of the Unix domain socket
+ * @return Function succeeded
+ */
+bool Server::start(const string &path)
+{
+    sockaddr_un address = {};
+    if (path.size() >= sizeof(address.sun_path))
+    {
+        cerr << "Socket path too long: " << path << endl;
+        return false;
+    }
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, path.c_str());
+
+    sigset_t signals = getServerSignals();
+
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+    listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    signalFd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (epollFd < 0 || listenFd < 0 || wakeFd < 0 || signalFd < 0)
+    {
+        perror("Error while creating server descriptors");
+        return false;
+    }
+
+    unlink(path.c_str());
+    if (bind(listenFd, (sockaddr *)&address, sizeof(address)) < 0 ||
+        listen(listenFd, SOMAXCONN) < 0)
+    {
+        perror(("Error while listening on " + path).c_str());
+        return false;
+    }
+    socketPath = path;
+
+    return addToEpoll(epollFd, listenFd, EPOLLIN, LISTEN_KEY) &&
+           addToEpoll(epollFd, wakeFd, EPOLLIN, WAKE_KEY) &&
+           addToEpoll(epollFd, signalFd, EPOLLIN, SIGNAL_KEY);
+}
+
+void Server::run()
+{
+    epoll_event events[SERVER_MAX_EVENTS];
+
+    while (running)
+    {
+        int eventNum = epoll_wait(epollFd, events, SERVER_MAX_EVENTS, -1);
+        if (eventNum < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("Error while waiting for events");
+            return;
+        }
+
+        for (int i = 0; i < eventNum; i++)
+        {
+            uint64_t key = events[i].data.u64;
+
+            if (key == LISTEN_KEY)
+                acceptConnections();
+            else if (key == WAKE_KEY)
+                drainCompletions();
+            else if (key == SIGNAL_KEY)
+                handleSignals();
+            else if (events[i].events & (EPOLLHUP | EPOLLERR))
+                closeConnection(key);
+            else
+            {
+                if (events[i].events & EPOLLIN)
+                    readConnection(key);
+                if (events[i].events & EPOLLOUT)
+                    writeConnection(key);
+            }
+        }
+    }
+}
+
+void Server::acceptConnections()
+{
+    while (true)
+    {
+        int fd = accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                perror("Error while accepting connection");
+            return;
+        }
+
+        uint64_t connectionId = nextConnectionId++;
+        if (!addToEpoll(epollFd, fd, EPOLLIN, connectionId))
+        {
+            close(fd);
+            continue;
+        }
+
+        auto connection = make_unique<Connection>();
+        connection->fd = fd;
+        connections[connectionId] = move(connection);
+    }
+}
+
+void Server::readConnection(uint64_t connectionId)
+{
+    auto it = connections.find(connectionId);
+    if (it == connections.end())
+        return;
+    Connection &connection = *it->second;
+
+    char buffer[SERVER_READ_SIZE];
+    while (connection.isReading)
+    {
+        ssize_t size = read(connection.fd, buffer, sizeof(buffer));
+        if (size > 0)
+        {
+            connection.input.append(buffer, (size_t)size);
+            dispatchRequests(connectionId, connection);
+            if (!connections.count(connectionId))
+                return;
+        }
+        else if (size == 0)
+        {
+            // Peer finished sending: answer what it asked, then close
+            connection.isReading = false;
+            connection.isPeerClosed = true;
+            if (connection.nextRequest == connection.nextResponse && connection.output.empty())
+            {
+                closeConnection(connectionId);
+                return;
+            }
+        }
+        else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+        {
+            closeConnection(connectionId);
+            return;
+        }
+        else if (errno != EINTR)
+            break;
+    }
+
+    updateEvents(connectionId, connection);
+}
+
+/**
+ * @brief Sends every complete request in the input buffer to the workers.
+ */
+void Server::dispatchRequests(uint64_t connectionId, Connection &connection)
+{
+    size_t position = 0;
+
+    while (connection.input.size() - position >= 4)
+    {
+        if (connection.nextRequest - connection.nextResponse >= SERVER_MAX_PENDING_REQUESTS)
+        {
+            connection.isReading = false;
+            break;
+        }
+
+        const unsigned char *header = (const unsigned char *)connection.input.data() + position;
+        size_t length = ((size_t)header[0] << 24) | ((size_t)header[1] << 16) |
+                        ((size_t)header[2] << 8) | (size_t)header[3];
+
+        if (length > SERVER_MAX_MESSAGE_SIZE)
+        {
+            cerr << "Request too large (" << length << " bytes), closing connection" << endl;
+            closeConnection(connectionId);
+            return;
+        }
+        if (connection.input.size() - position - 4 < length)
+            break;
+
+        uint64_t sequence = connection.nextRequest++;
+        auto request = make_shared<string>(connection.input, position + 4, length);
+        position += 4 + length;
+
+        pool->submit([this, connectionId, sequence, request]() {
+            Workspace &workspace = getThreadWorkspace();
+            Workspace::Scope scope(workspace);
+            Text text(workspace.getResource());
+            string response;
+
+            try
+            {
+                getTextFromString(*request, text);
+                IdentifyOptions options;
+                options.cache = cache.getCapacity() ? &cache : nullptr;
+                LanguageGuess guess = guessLanguage(text, languages, workspace, options);
+                response = guess.languageCode + '\t' + to_string(guess.similarity);
+            }
+            catch (const exception &)
+            {
+                response = "error";
+            }
+
+            {
+                lock_guard<mutex> guard(completionLock);
+                completions.push_back({connectionId, sequence, move(response)});
+            }
+
+            uint64_t one = 1;
+            if (write(wakeFd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+                perror("Error while waking the event loop");
+        });
+    }
+
+    connection.input.erase(0, position);
+}
+
+/**
+ * @brief Queues finished responses on their connections, in request order.
+ *
+ * Only the connections named by the completions are visited, so a wake-up
+ * costs O(completions) whatever the number of open connections.
+ */
+void Server::drainCompletions()
+{
+    uint64_t count;
+    while (read(wakeFd, &count, sizeof(count)) > 0)
+        ;
+
+    vector<Completion> finished;
+    {
+        lock_guard<mutex> guard(completionLock);
+        finished.swap(completions);
+    }
+
+    vector<uint64_t> finishedIds;
+    finishedIds.reserve(finished.size());
+    for (auto &completion : finished)
+    {
+        auto it = connections.find(completion.connectionId);
+        if (it == connections.end())
+            continue;
+
+        Connection &connection = *it->second;
+        connection.readyResponses[completion.sequence] = move(completion.response);
+        finishedIds.push_back(completion.connectionId);
+    }
+
+    sort(finishedIds.begin(), finishedIds.end());
+    finishedIds.erase(unique(finishedIds.begin(), finishedIds.end()), finishedIds.end());
+
+    // Writing may close connections, so look each one up again
+    for (uint64_t connectionId : finishedIds)
+    {
+        auto connectionIt = connections.find(connectionId);
+        if (connectionIt == connections.end())
+            continue;
+        Connection &connection = *connectionIt->second;
+        bool hasNewOutput = false;
+
+        auto it = connection.readyResponses.begin();
+        while (it != connection.readyResponses.end() && it->first == connection.nextResponse)
+        {
+            appendMessage(connection.output, it->second);
+            it = connection.readyResponses.erase(it);
+            connection.nextResponse++;
+            hasNewOutput = true;
+        }
+
+        if (hasNewOutput)
+        {
+            connection.isWriting = true;
+            writeConnection(connectionId);
+        }
+    }
+}
+
+void Server::writeConnection(uint64_t connectionId)
+{
+    auto it = connections.find(connectionId);
+    if (it == connections.end())
+        return;
+    Connection &connection = *it->second;
+
+    size_t position = 0;
+    while (position < connection.output.size())
+    {
+        ssize_t size = write(connection.fd, connection.output.data() + position,
+                             connection.output.size() - position);
+        if (size > 0)
+            position += (size_t)size;
+        else if (errno == EINTR)
+            continue;
+        else if (errno == EAGAIN || errno == EWOULDBLOCK)
+            break;
+        else
+        {
+            closeConnection(connectionId);
+            return;
+        }
+    }
+    connection.output.erase(0, position);
+    connection.isWriting = !connection.output.empty();
+
+    if (connection.isPeerClosed && !connection.isWriting &&
+        connection.nextRequest == connection.nextResponse)
+    {
+        closeConnection(connectionId);
+        return;
+    }
+
+    // Responses went out: resume reading requests buffered while saturated
+    if (!connection.isReading && !connection.isPeerClosed &&
+        connection.nextRequest - connection.nextResponse < SERVER_MAX_PENDING_REQUESTS)
+    {
+        connection.isReading = true;
+        dispatchRequests(connectionId, connection);
+        if (!connections.count(connectionId))
+            return;
+    }
+
+    updateEvents(connectionId, connection);
+}
+
+void Server::updateEvents(uint64_t connectionId, Connection &connection)
+{
+    epoll_event event = {};
+    event.events = (connection.isReading ? (uint32_t)EPOLLIN : 0u) |
+                   (connection.isWriting ? (uint32_t)EPOLLOUT : 0u);
+    event.data.u64 = connectionId;
+    epoll_ctl(epollFd, EPOLL_CTL_MOD, connection.fd, &event);
+}
+
+void Server::closeConnection(uint64_t connectionId)
+{
+    auto it = connections.find(connectionId);
+    if (it == connections.end())
+        return;
+
+    close(it->second->fd);
+    connections.erase(it);
+}
+
+void Server::handleSignals()
+{
+    signalfd_siginfo info;
+    while (read(signalFd, &info, sizeof(info)) == sizeof(info))
+    {
+        if (info.ssi_signo == SIGUSR1)
+            cerr << getMetricsJSON() << endl;
+        else if (info.ssi_signo == SIGINT || info.ssi_signo == SIGTERM)
+            running = false;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned threadNum = 0;
+    size_t maxTrigrams = 0;
+    size_t cacheSize = 65536;
+    string tracePath;
+    string socketPath;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "-j") && i + 1 < argc)
+            threadNum = (unsigned)stoul(argv[++i]);
+        else if (!strcmp(argv[i], "--max-trigrams") && i + 1 < argc)
+            maxTrigrams = stoul(argv[++i]);
+        else if (!strcmp(argv[i], "--cache-size") && i + 1 < argc)
+            cacheSize = stoul(argv[++i]);
+        else if (!strcmp(argv[i], "--trace") && i + 1 < argc)
+            tracePath = argv[++i];
+        else
+            socketPath = argv[i];
+    }
+
+    if (socketPath.empty())
+    {
+        cerr << "Usage: lequel-server [-j threads] [--max-trigrams N] [--cache-size N] [--trace path] socket_path"
+             << endl;
+        return 1;
+    }
+
+    if (!tracePath.empty())
+        startTrace();
+
+    map<string, string> languageCodeNames;
+    LanguageProfiles languages;
+
+    if (!loadLanguagesData(languageCodeNames, languages, maxTrigrams))
+    {
+        cerr << "Could not load language data" << endl;
+        return 1;
+    }
+
+    sigset_t signals = getServerSignals();
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+    {
+        Server server(languages, threadNum, cacheSize);
+        if (!server.start(socketPath))
+            return 1;
+
+        server.run();
+    }
+
+    // The workers are gone: every span is complete
+    if (!tracePath.empty())
+    {
+        stopTrace();
+        if (!writeTraceJSON(tracePath))
+            return 1;
+    }
+
+    return 0;
+}
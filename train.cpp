@@ -0,0 +1,210 @@
+/**
+ * @brief Lequel? language profile training tool
+ * @author Dylan Frigerio, Micaela Dinsen
+ *
+ * @copyright Copyright (c) 2022-2023
+ *
+ * Usage: lequel-train [-n rows] [-j threads] corpus_dir output_dir
+ *
+ * Every regular file corpus_dir/<code>.<ext> is the corpus of language
+ * <code>. The corpus is memory-mapped and cut into chunks at line breaks;
+ * workers count the chunks into per-worker maps that are then merged
+ * pairwise. The most frequent trigrams are written to output_dir/<code>.csv
+ * (same format as resources/trigrams) and output_dir/<code>.bin.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "CSVData.h"
+#include "Lequel.h"
+#include "MappedFile.h"
+#include "Model.h"
+#include "ThreadPool.h"
+
+using namespace std;
+using namespace std::chrono;
+
+const size_t TRAIN_CHUNK_SIZE = 4 << 20;
+const size_t TRAIN_DEFAULT_ROWS = 2000;
+
+/**
+ * @brief Cuts a buffer into chunks of about TRAIN_CHUNK_SIZE bytes that end at
+ *        a line break, so no trigram spans two chunks.
+ *
+ * @return Chunk boundaries: chunk i is [bounds[i], bounds[i + 1])
+ */
+static vector<size_t> splitIntoChunks(const char *data, size_t size)
+{
+    vector<size_t> bounds = {0};
+
+    while (bounds.back() < size)
+    {
+        size_t end = bounds.back() + TRAIN_CHUNK_SIZE;
+        if (end >= size)
+            end = size;
+        else
+        {
+            const char *lineBreak = (const char *)memchr(data + end, '\n', size - end);
+            end = lineBreak ? (size_t)(lineBreak - data) + 1 : size;
+        }
+        bounds.push_back(end);
+    }
+    return bounds;
+}
+
+/**
+ * @brief Counts the trigrams of a corpus with every pool worker.
+ */
+static void countCorpus(ThreadPool &pool, const MappedFile &corpus, TrigramCounts &counts)
+{
+    const char *data = corpus.getData();
+    vector<size_t> bounds = splitIntoChunks(data, corpus.getSize());
+    vector<TrigramCounts> workerCounts(pool.getThreadCount());
+
+    pool.parallelFor(bounds.size() - 1, [&](size_t chunk, unsigned worker) {
+        Workspace &workspace = getThreadWorkspace();
+        Workspace::Scope scope(workspace);
+        Text text(workspace.getResource());
+
+        getTextFromBuffer(data + bounds[chunk], bounds[chunk + 1] - bounds[chunk], text);
+        countTrigrams(text, workerCounts[worker]);
+    });
+
+    mergeTrigramCounts(workerCounts, pool);
+    counts = move(workerCounts[0]);
+}
+
+/**
+ * @brief Whether a trigram holds a control character (such as a lone '\r'):
+ *        no evidence of a language, and a CSV row cannot hold '\r' or '\n'.
+ */
+static bool hasControlCharacter(uint64_t trigram)
+{
+    for (int i = 0; i < 3; i++)
+    {
+        uint64_t codePoint = (trigram >> (i * TRIGRAM_CODEPOINT_BITS)) & TRIGRAM_CODEPOINT_MASK;
+        if (codePoint < 0x20 || codePoint == 0x7F)
+            return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Picks the most frequent trigrams (ties broken by trigram value, so
+ *        the output is deterministic), leaving out those with control
+ *        characters.
+ */
+static TrigramFrequencies getTopTrigrams(const TrigramCounts &counts, size_t rowNum)
+{
+    TrigramFrequencies frequencies;
+    frequencies.reserve(counts.size());
+    for (const auto &[trigram, count] : counts)
+    {
+        if (!hasControlCharacter(trigram))
+            frequencies.emplace_back(trigram, count);
+    }
+
+    rowNum = min(rowNum, frequencies.size());
+    partial_sort(frequencies.begin(), frequencies.begin() + rowNum, frequencies.end(),
+                 [](const auto &a, const auto &b) {
+                     return (a.second != b.second) ? (a.second > b.second) : (a.first < b.first);
+                 });
+    frequencies.resize(rowNum);
+
+    return frequencies;
+}
+
+static void printUsage()
+{
+    cerr << "Usage: lequel-train [-n rows] [-j threads] corpus_dir output_dir" << endl;
+}
+
+int main(int argc, char *argv[])
+{
+    size_t rowNum = TRAIN_DEFAULT_ROWS;
+    unsigned threadNum = 0;
+    vector<string> arguments;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "-n") && i + 1 < argc)
+            rowNum = stoul(argv[++i]);
+        else if (!strcmp(argv[i], "-j") && i + 1 < argc)
+            threadNum = (unsigned)stoul(argv[++i]);
+        else
+            arguments.push_back(argv[i]);
+    }
+
+    if (arguments.size() != 2 || !rowNum)
+    {
+        printUsage();
+        return 1;
+    }
+
+    const filesystem::path corpusDir = arguments[0];
+    const filesystem::path outputDir = arguments[1];
+
+    error_code error;
+    vector<filesystem::path> corpusPaths;
+    for (const auto &entry : filesystem::directory_iterator(corpusDir, error))
+    {
+        if (entry.is_regular_file())
+            corpusPaths.push_back(entry.path());
+    }
+    if (error)
+    {
+        cerr << "Error while reading directory " << corpusDir << ": " << error.message() << endl;
+        return 1;
+    }
+    sort(corpusPaths.begin(), corpusPaths.end());
+
+    filesystem::create_directories(outputDir, error);
+
+    ThreadPool pool(threadNum);
+    int result = 0;
+
+    for (const auto &corpusPath : corpusPaths)
+    {
+        const string languageCode = corpusPath.stem().string();
+        auto startTime = steady_clock::now();
+
+        MappedFile corpus;
+        if (!corpus.open(corpusPath.string()))
+        {
+            result = 1;
+            continue;
+        }
+
+        TrigramCounts counts;
+        countCorpus(pool, corpus, counts);
+
+        TrigramFrequencies frequencies = getTopTrigrams(counts, rowNum);
+
+        CSVData csvData;
+        csvData.reserve(frequencies.size());
+        for (auto &[trigram, count] : frequencies)
+            csvData.push_back({intToStringTrigram(trigram), to_string(count)});
+
+        const string outputPath = (outputDir / languageCode).string();
+        if (!writeCSV(outputPath + ".csv", csvData) ||
+            !writeBinaryProfile(outputPath + ".bin", frequencies))
+        {
+            cerr << "Error while writing " << outputPath << endl;
+            result = 1;
+            continue;
+        }
+
+        double seconds = duration<double>(steady_clock::now() - startTime).count();
+        cout << languageCode << ": " << corpus.getSize() << " bytes, " << counts.size()
+             << " unique trigrams, " << seconds << " s ("
+             << corpus.getSize() / 1e6 / max(seconds, 1e-9) << " MB/s)" << endl;
+    }
+
+    return result;
+}